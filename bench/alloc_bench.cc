@@ -0,0 +1,80 @@
+/*
+    统计每条日志在稳定运行后的内存申请次数
+        1. 替换全局 operator new, 对申请次数进行计数
+        2. 先输出一批日志进行预热, 让各个线程复用的缓冲区扩充到稳定大小
+        3. 再输出指定数量的日志, 计算平均每条日志的申请次数
+*/
+#include "../logs/bitlog.h"
+#include <chrono>
+#include <new>
+
+static std::atomic<size_t> g_alloc_count(0);
+
+// 替换的全局分配函数不能被内联, 否则编译器会把内联后的 free 与 operator new 当作不配对的分配/释放
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+__attribute__((noinline)) void *operator new[](size_t size) { return operator new(size); }
+// 与上面的 operator new/new[] 配对, 包括带大小的版本
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// 丢弃所有数据的落地方向, 避免落地过程本身影响统计
+class NullSink : public zx::LogSink
+{
+public:
+    void log(const char *, size_t) {}
+};
+
+void alloc_bench(const std::string &logger_name, size_t msg_count)
+{
+    zx::Logger::ptr logger = zx::getLogger(logger_name);
+    if (logger.get() == nullptr)
+        return;
+    std::string user = "user-1024";
+    // 预热
+    for (size_t i = 0; i < 1000; i++)
+        logger->info("user {} took {}us, ratio {}", user, i, 0.5);
+
+    size_t before = g_alloc_count.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < msg_count; i++)
+        logger->info("user {} took {}us, ratio {}", user, i, 0.5);
+    auto end = std::chrono::high_resolution_clock::now();
+    size_t allocs = g_alloc_count.load() - before;
+    std::chrono::duration<double> cost = end - start;
+    std::cout << logger_name << ":\n";
+    std::cout << "\t输出数量: " << msg_count << ", 耗时: " << cost.count() << "s\n";
+    std::cout << "\t每条日志耗时: " << cost.count() * 1e9 / msg_count << "ns\n";
+    std::cout << "\t每条日志内存申请次数: " << (double)allocs / msg_count << "\n";
+}
+
+void build(const std::string &logger_name, zx::LoggerType type, bool deferred)
+{
+    std::unique_ptr<zx::LoggerBuilder> builder(new zx::GlobalLoggerBuilder());
+    builder->buildLoggerName(logger_name);
+    builder->buildFormatter("[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n");
+    builder->buildLoggerType(type);
+    if (deferred)
+        builder->buildEnableDeferredFormat();
+    builder->buildSink<NullSink>();
+    builder->build();
+}
+
+int main()
+{
+    build("sync_logger", zx::LoggerType::LOGGER_SYNC, false);
+    build("async_logger", zx::LoggerType::LOGGER_ASYNC, false);
+    build("deferred_logger", zx::LoggerType::LOGGER_ASYNC, true);
+    alloc_bench("sync_logger", 1000000);
+    alloc_bench("async_logger", 1000000);
+    alloc_bench("deferred_logger", 1000000);
+    return 0;
+}
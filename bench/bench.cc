@@ -32,7 +32,7 @@ void bench(const std::string &logger_name, size_t thr_count, size_t msg_count, s
                                  // 4. 线程函数内部开始计时
                                  auto start = std::chrono::high_resolution_clock::now();
                                  // 5. 开始循环写日志
-                                 for (int j = 0; i < msg_per_thr; j++)
+                                 for (size_t j = 0; j < msg_per_thr; j++)
                                  {
                                      logger->fatal("%s", msg.c_str());
                                  }
@@ -79,12 +79,25 @@ void async_bench()
     builder->buildEnableUnSafeAsync();
     builder->buildSink<zx::FileSink>("./logfile/async.log");
     builder->build();
-    bench("sync_logger", 1, 1, 100);
+    bench("async_logger", 1, 1, 100);
+}
+
+void lockfree_bench()
+{
+    std::unique_ptr<zx::LoggerBuilder> builder(new zx::GlobalLoggerBuilder());
+    builder->buildLoggerName("lockfree_logger");
+    builder->buildFormatter("%m%n");
+    builder->buildLoggerType(zx::LoggerType::LOGGER_ASYNC);
+    builder->buildEnableLockFreeAsync();
+    builder->buildSink<zx::FileSink>("./logfile/lockfree.log");
+    builder->build();
+    bench("lockfree_logger", 1, 1, 100);
 }
 
 int main()
 {
     sync_bench();
     // async_bench();
+    lockfree_bench();
     return 0;
 }
@@ -0,0 +1,80 @@
+/*
+    对比格式化器的耗时
+        1. 旧: 格式化子项逐个虚函数调用 (formatByItems)
+        2. 新: 编译后的指令数组, switch 循环直接追加到缓冲区 (format)
+        3. 绑定日志器后的格式化器 --> %c 也与相邻的原始字符串合并, 同样对比子项与指令数组
+    同时校验各种方式的输出以及长度上限完全一致
+*/
+#include "../logs/bitlog.h"
+#include <chrono>
+
+static const zx::LogSite g_site("bench/format_bench.cc", 12, zx::LogLevel::value::INFO, "{}");
+
+// 通过成员函数指针调用, 两种方式都不会被内联到计时循环中, 与日志器中的调用方式一致
+typedef void (zx::Formatter::*FormatFunc)(zx::FmtBuffer &, const zx::LogMsg &);
+
+double costOf(size_t count, zx::Formatter &fmt, FormatFunc func, const zx::LogMsg &msg)
+{
+    zx::FmtBuffer buf;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        buf.clear();
+        (fmt.*func)(buf, msg);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> cost = end - start;
+    return cost.count() * 1e9 / count;
+}
+
+bool sameOutput(const zx::FmtBuffer &a, const zx::FmtBuffer &b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+void format_bench(const std::string &pattern, size_t count)
+{
+    zx::Formatter fmt(pattern);
+    zx::Formatter::ptr bound = fmt.bindLogger("bench_logger");
+    std::string payload = "user user-1024 took 35us, ratio 0.5";
+    zx::LogMsg msg(&g_site, "bench_logger", payload.data(), payload.size());
+
+    zx::FmtBuffer items_out, out, bound_items_out, bound_out;
+    fmt.formatByItems(items_out, msg);
+    fmt.format(out, msg);
+    bound->formatByItems(bound_items_out, msg);
+    bound->format(bound_out, msg);
+    if (!sameOutput(items_out, out) || !sameOutput(items_out, bound_items_out) || !sameOutput(items_out, bound_out))
+    {
+        std::cout << "输出不一致: " << pattern << "\n";
+        abort();
+    }
+    if (fmt.sizeHint(msg) != fmt.sizeHintByItems(msg) || bound->sizeHint(msg) != bound->sizeHintByItems(msg))
+    {
+        std::cout << "长度上限不一致: " << pattern << "\n";
+        abort();
+    }
+
+    FormatFunc by_items = &zx::Formatter::formatByItems;
+    FormatFunc by_program = &zx::Formatter::format;
+    double items_cost = costOf(count, fmt, by_items, msg);
+    double cost = costOf(count, fmt, by_program, msg);
+    double bound_items_cost = costOf(count, *bound, by_items, msg);
+    double bound_cost = costOf(count, *bound, by_program, msg);
+    std::cout << "格式: " << pattern << "\n";
+    std::cout << "\t格式化子项:            " << items_cost << "ns/条\n";
+    std::cout << "\t指令数组:              " << cost << "ns/条\n";
+    std::cout << "\t绑定日志器, 格式化子项: " << bound_items_cost << "ns/条\n";
+    std::cout << "\t绑定日志器, 指令数组:   " << bound_cost << "ns/条\n";
+}
+
+int main()
+{
+    format_bench("[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n", 1000000);
+    format_bench("[%t][%c][%f:%l][%p]%T%m%n", 1000000);
+    format_bench("%m%n", 1000000);
+    format_bench("%%[%p]%T%T<%c> %f:%l %m %d{%Y-%m-%d}%n", 1000000);
+    format_bench("[%d{%H:%M:%S}.%e][%p]%T%m%n", 1000000);
+    format_bench("[%D][%Z][%u][%N][%s]%m%n", 1000000);
+    return 0;
+}
@@ -0,0 +1,246 @@
+/*
+    示例程序共用的写入与检查
+        1. 多个线程同时写日志, 每行的格式为 "<秒>.<纳秒> t<线程> i<序号>"
+            --> 日志器格式为 PATTERN, 消息为 "t{} i{}"
+        2. 读回日志文件, 检查总行数, 每个线程的日志保持写入顺序, 需要时检查整体按时间戳有序
+        3. 滚动产生的多个文件按滚动顺序排列后拼接, 每个文件都以完整的一行结尾, 没有残留的 0 字节与临时文件
+*/
+#ifndef __M_CHECK_H__
+#define __M_CHECK_H__
+
+#include "../logs/bitlog.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <unistd.h>
+
+namespace check
+{
+    const char *const PATTERN = "%d{%s}.%N %m%n";
+
+    struct Line
+    {
+        long long _stamp; // 打印的时间戳, 纳秒
+        int _thread;
+        long _seq;
+    };
+
+    inline bool parseLine(const std::string &text, Line &line)
+    {
+        long long sec, nsec;
+        if (sscanf(text.c_str(), "%lld.%lld t%d i%ld", &sec, &nsec, &line._thread, &line._seq) != 4)
+            return false;
+        line._stamp = sec * 1000000000LL + nsec;
+        return true;
+    }
+
+    // threads 个线程各写 count 条日志
+    inline void writeLines(const zx::Logger::ptr &logger, int threads, long count)
+    {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t)
+            workers.emplace_back([&logger, t, count]()
+                                 {
+                for (long i = 0; i < count; ++i)
+                    logger->info("t{} i{}", t, i); });
+        for (auto &w : workers)
+            w.join();
+    }
+
+    // 创建目录并删除其中的文件, 每个检查使用单独的目录
+    inline void resetDir(const std::string &dir)
+    {
+        zx::util::File::createDirectory(dir + "/");
+        DIR *d = opendir(dir.c_str());
+        if (d == nullptr)
+            return;
+        while (struct dirent *e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name != "." && name != "..")
+                unlink((dir + "/" + name).c_str());
+        }
+        closedir(d);
+    }
+
+    inline std::vector<std::string> listFiles(const std::string &dir)
+    {
+        std::vector<std::string> files;
+        DIR *d = opendir(dir.c_str());
+        if (d == nullptr)
+            return files;
+        while (struct dirent *e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name != "." && name != "..")
+                files.push_back(dir + "/" + name);
+        }
+        closedir(d);
+        return files;
+    }
+
+    // 滚动文件的改名与关闭在后台线程中完成, 等它处理完已经提交的任务
+    inline void waitFileHelper()
+    {
+        auto done = std::make_shared<std::promise<void>>();
+        std::future<void> f = done->get_future();
+        zx::FileHelper::shared()->post([done]()
+                                       { done->set_value(); });
+        f.wait();
+    }
+
+    class Checker
+    {
+    public:
+        Checker(const std::string &name) : _name(name), _ok(true) {}
+
+        // 读入目录下的所有日志文件并按滚动顺序排列
+        //  by_sequence 为 true 时按文件名末尾 "-<序号>.log" 中的序号排列(按大小滚动, 分段映射);
+        //  否则按第一行的时间戳排列, 只适用于单线程写入: 多线程时文件的第一行不一定是其中最早的日志
+        void readDir(const std::string &dir, bool by_sequence)
+        {
+            std::vector<std::pair<long long, std::vector<Line>>> files;
+            for (auto &path : listFiles(dir))
+            {
+                if (path.size() < 4 || path.compare(path.size() - 4, 4, ".log") != 0)
+                {
+                    fail("残留的文件 " + path);
+                    continue;
+                }
+                long long key = 0;
+                if (by_sequence && !parseSequence(path, key))
+                {
+                    fail("文件名中没有序号 " + path);
+                    continue;
+                }
+                std::vector<Line> lines;
+                readFile(path, lines);
+                if (lines.empty())
+                    continue;
+                if (!by_sequence)
+                    key = lines.front()._stamp;
+                files.emplace_back(key, std::move(lines));
+            }
+            std::sort(files.begin(), files.end(),
+                      [](const std::pair<long long, std::vector<Line>> &a, const std::pair<long long, std::vector<Line>> &b)
+                      { return a.first < b.first; });
+            for (auto &f : files)
+                _lines.insert(_lines.end(), f.second.begin(), f.second.end());
+            _files = files.size();
+        }
+
+        void readFile(const std::string &path)
+        {
+            readFile(path, _lines);
+            _files = 1;
+        }
+
+        // 检查行数与每个线程的顺序, ordered 为 true 时还要求整体按时间戳有序
+        void verify(int threads, long count, bool ordered = false)
+        {
+            if (_lines.size() != (size_t)threads * count)
+            {
+                std::stringstream ss;
+                ss << "行数 " << _lines.size() << ", 应为 " << (size_t)threads * count;
+                fail(ss.str());
+            }
+            std::vector<long> next(threads, 0);
+            long long last = 0;
+            size_t disorder = 0, unordered = 0;
+            for (auto &line : _lines)
+            {
+                if (line._thread < 0 || line._thread >= threads)
+                {
+                    ++disorder;
+                    continue;
+                }
+                if (line._seq != next[line._thread])
+                    ++disorder;
+                next[line._thread] = line._seq + 1;
+                if (line._stamp < last)
+                    ++unordered;
+                last = std::max(last, line._stamp);
+            }
+            if (disorder > 0)
+                fail("线程内顺序错误 " + std::to_string(disorder) + " 处");
+            if (ordered && unordered > 0)
+                fail("时间戳乱序 " + std::to_string(unordered) + " 处");
+        }
+
+        // 滚动至少产生了 n 个文件
+        void expectFiles(size_t n)
+        {
+            if (_files < n)
+                fail("只有 " + std::to_string(_files) + " 个文件, 应至少 " + std::to_string(n) + " 个");
+        }
+
+        bool report()
+        {
+            std::cout << _name << ": " << _lines.size() << " 行, " << _files << " 个文件 --> "
+                      << (_ok ? "通过" : "失败") << "\n";
+            return _ok;
+        }
+
+    private:
+        // path 形如 ".../<名字>-<序号>.log"
+        static bool parseSequence(const std::string &path, long long &seq)
+        {
+            size_t dash = path.find_last_of('-');
+            size_t dot = path.size() - 4;
+            if (dash == std::string::npos || dash + 1 >= dot)
+                return false;
+            seq = 0;
+            for (size_t i = dash + 1; i < dot; ++i)
+            {
+                if (path[i] < '0' || path[i] > '9')
+                    return false;
+                seq = seq * 10 + (path[i] - '0');
+            }
+            return true;
+        }
+
+        void readFile(const std::string &path, std::vector<Line> &lines)
+        {
+            std::ifstream ifs(path, std::ios::binary);
+            std::string body((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            if (body.empty())
+                return;
+            if (body.back() != '\n')
+                fail(path + " 没有以完整的一行结尾");
+            if (body.find('\0') != std::string::npos)
+                fail(path + " 中有残留的 0 字节");
+            std::stringstream ss(body);
+            std::string text;
+            while (std::getline(ss, text))
+            {
+                Line line;
+                if (parseLine(text, line))
+                    lines.push_back(line);
+                else
+                    fail(path + " 中格式错误的行: " + text);
+            }
+        }
+
+        void fail(const std::string &msg)
+        {
+            if (_ok)
+                std::cout << _name << ": " << msg << "\n";
+            _ok = false;
+        }
+
+    private:
+        std::string _name;
+        bool _ok;
+        size_t _files = 0;
+        std::vector<Line> _lines;
+    };
+} // namespace check
+
+#endif
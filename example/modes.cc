@@ -0,0 +1,89 @@
+/*
+    逐个检查日志器的工作模式
+        1. 同步, 以及各种异步模式(互斥锁, 非安全, 无锁, 每线程队列, 全局有序, 延迟格式化, 共享工作线程)
+        2. 多个线程同时写入后读回日志文件, 检查行数与每个线程的顺序; 全局有序模式还要检查时间戳有序
+        3. 运行时的 std::string / const char * 格式化字符串
+*/
+#include "check.hpp"
+
+#define THREADS 4
+#define COUNT 50000
+
+static const std::string LOG_DIR = "./logfile/modes";
+
+// setup 设置工作模式, 返回检查是否通过
+template <typename F>
+bool checkMode(const std::string &name, F setup, bool ordered = false)
+{
+    std::string pathname = LOG_DIR + "/" + name + ".log";
+    {
+        zx::LocalLoggerBuilder builder;
+        builder.buildLoggerName(name);
+        builder.buildFormatter(check::PATTERN);
+        builder.buildSink<zx::FileSink>(pathname);
+        setup(builder);
+        zx::Logger::ptr logger = builder.build();
+        check::writeLines(logger, THREADS, COUNT);
+    }
+    check::Checker checker(name);
+    checker.readFile(pathname);
+    checker.verify(THREADS, COUNT, ordered);
+    return checker.report();
+}
+
+// 运行时的格式化字符串按 printf 风格处理: std::string 与 const char * 变量交替使用
+bool checkRuntimeFmt()
+{
+    std::string pathname = LOG_DIR + "/runtime.log";
+    {
+        zx::LocalLoggerBuilder builder;
+        builder.buildLoggerName("runtime");
+        builder.buildFormatter(check::PATTERN);
+        builder.buildSink<zx::FileSink>(pathname);
+        builder.buildLoggerType(zx::LoggerType::LOGGER_SYNC);
+        zx::Logger::ptr logger = builder.build();
+        std::string fmt = "t%d i%ld";
+        const char *cfmt = fmt.c_str();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < THREADS; ++t)
+            workers.emplace_back([&, t]()
+                                 {
+                for (long i = 0; i < COUNT; ++i)
+                {
+                    if (i % 2 == 0)
+                        logger->info(fmt, t, i);
+                    else
+                        logger->info(cfmt, t, i);
+                } });
+        for (auto &w : workers)
+            w.join();
+    }
+    check::Checker checker("runtime");
+    checker.readFile(pathname);
+    checker.verify(THREADS, COUNT);
+    return checker.report();
+}
+
+int main()
+{
+    check::resetDir(LOG_DIR);
+    bool ok = true;
+    ok &= checkMode("sync", [](zx::LocalLoggerBuilder &b)
+                    { b.buildLoggerType(zx::LoggerType::LOGGER_SYNC); });
+    ok &= checkMode("safe", [](zx::LocalLoggerBuilder &) {});
+    ok &= checkMode("unsafe", [](zx::LocalLoggerBuilder &b)
+                    { b.buildEnableUnSafeAsync(); });
+    ok &= checkMode("lockfree", [](zx::LocalLoggerBuilder &b)
+                    { b.buildEnableLockFreeAsync(); });
+    ok &= checkMode("perthread", [](zx::LocalLoggerBuilder &b)
+                    { b.buildEnablePerThreadAsync(); });
+    // 窗口放宽到 20ms, 避免机器繁忙时生产者被调度出去太久
+    ok &= checkMode("ordered", [](zx::LocalLoggerBuilder &b)
+                    { b.buildEnableOrderedAsync(std::chrono::microseconds(20000)); }, true);
+    ok &= checkMode("deferred", [](zx::LocalLoggerBuilder &b)
+                    { b.buildEnableDeferredFormat(); });
+    ok &= checkMode("pool", [](zx::LocalLoggerBuilder &b)
+                    { b.buildWorkerPool(); });
+    ok &= checkRuntimeFmt();
+    return ok ? 0 : 1;
+}
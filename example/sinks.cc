@@ -0,0 +1,90 @@
+/*
+    逐个检查文件落地方向
+        1. 普通文件与 io_uring 文件: 行数与每个线程的顺序
+        2. 按大小滚动, 分段映射与按时间滚动: 产生了多个文件, 按顺序拼接后行数与顺序不变,
+           每个文件都以完整的一行结尾, 没有残留的临时文件
+*/
+#include "check.hpp"
+
+#define THREADS 4
+#define COUNT 50000
+#define ROLL_SIZE (256 * 1024)
+
+static const std::string LOG_DIR = "./logfile/sinks";
+
+// 写日志, addSink 添加要检查的落地方向
+template <typename F>
+void writeTo(const std::string &name, F addSink, int threads, long count)
+{
+    zx::LocalLoggerBuilder builder;
+    builder.buildLoggerName(name);
+    builder.buildFormatter(check::PATTERN);
+    addSink(builder);
+    zx::Logger::ptr logger = builder.build();
+    check::writeLines(logger, threads, count);
+}
+
+bool checkFile(const std::string &name, const std::string &pathname)
+{
+    check::Checker checker(name);
+    checker.readFile(pathname);
+    checker.verify(THREADS, COUNT);
+    return checker.report();
+}
+
+bool checkRolled(const std::string &name, const std::string &dir, bool by_sequence, int threads, long count, size_t files)
+{
+    // 滚动下来的文件在后台线程中改名与关闭
+    check::waitFileHelper();
+    check::Checker checker(name);
+    checker.readDir(dir, by_sequence);
+    checker.verify(threads, count);
+    checker.expectFiles(files);
+    return checker.report();
+}
+
+int main()
+{
+    bool ok = true;
+
+    std::string file = LOG_DIR + "/file/file.log";
+    check::resetDir(LOG_DIR + "/file");
+    writeTo("file", [&](zx::LocalLoggerBuilder &b)
+            { b.buildSink<zx::FileSink>(file); }, THREADS, COUNT);
+    ok &= checkFile("file", file);
+
+    std::string uring = LOG_DIR + "/uring/uring.log";
+    check::resetDir(LOG_DIR + "/uring");
+    writeTo("uring", [&](zx::LocalLoggerBuilder &b)
+            { b.buildSink<zx::UringFileSink>(uring); }, THREADS, COUNT);
+    ok &= checkFile("uring", uring);
+
+    // 每行约 30 字节, 总共约 6MB, 至少滚动出 4 个文件
+    check::resetDir(LOG_DIR + "/size");
+    writeTo("size", [&](zx::LocalLoggerBuilder &b)
+            { b.buildSink<zx::FileBySizeSink>(LOG_DIR + "/size/size-", ROLL_SIZE, zx::SyncOptions(), true); },
+            THREADS, COUNT);
+    ok &= checkRolled("size", LOG_DIR + "/size", true, THREADS, COUNT, 4);
+
+    check::resetDir(LOG_DIR + "/mmap");
+    writeTo("mmap", [&](zx::LocalLoggerBuilder &b)
+            { b.buildSink<zx::MmapFileSink>(LOG_DIR + "/mmap/mmap-", ROLL_SIZE); }, THREADS, COUNT);
+    ok &= checkRolled("mmap", LOG_DIR + "/mmap", true, THREADS, COUNT, 4);
+
+    // 单线程慢速写入约 2.5 秒, 跨过至少两个秒边界; 文件名中没有序号, 按第一行的时间戳排列
+    check::resetDir(LOG_DIR + "/time");
+    {
+        zx::LocalLoggerBuilder builder;
+        builder.buildLoggerName("time");
+        builder.buildFormatter(check::PATTERN);
+        builder.buildSink<zx::FileByTimeSink>(LOG_DIR + "/time/time-", zx::TimeGap::GAP_SECOND);
+        zx::Logger::ptr logger = builder.build();
+        for (long i = 0; i < 2500; ++i)
+        {
+            logger->info("t{} i{}", 0, i);
+            usleep(1000);
+        }
+    }
+    ok &= checkRolled("time", LOG_DIR + "/time", false, 1, 2500, 3);
+    return ok ? 0 : 1;
+}
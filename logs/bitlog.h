@@ -21,19 +21,46 @@ namespace zx
         return zx::LoggerManager::getInstance().rootLogger();
     }
 
+    // 所有日志器的异步缓冲区共享的内存预算, 0 表示不限制; 预算用完后非安全模式的缓冲区不再扩容, 按溢出策略处理
+    inline void setMemoryBudget(size_t bytes)
+    {
+        MemoryBudget::getInstance().setLimit(bytes);
+    }
+
+    // 根日志器在 LoggerManager 构造后不再改变, 缓存裸指针, 避免每条日志拷贝一次 shared_ptr
+    inline Logger *rootLoggerPtr()
+    {
+        static Logger *root = LoggerManager::getInstance().rootLogger().get();
+        return root;
+    }
+
     // 2. 使用宏函数对日志器的接口进行代理  --> 代理模式
-#define debug(fmt, ...) debug(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define info(fmt, ...) info(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define warn(fmt, ...) warn(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define error(fmt, ...) error(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define fatal(fmt, ...) fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+    //    fmt 为字符串字面量时: 含 {} 时按参数类型格式化并在编译期校验参数个数, 否则按 printf 风格处理
+    //    logger->info("user {} took {}us", id, t);   logger->info("%s", msg.c_str());
+    //    fmt 也可以是运行时的 std::string 或 const char *, 按 printf 风格处理: logger->info(fmt_str, id);
+    //    每个调用点生成一个静态的 LogSite 描述符, 保存文件名/行号/等级/格式化字符串
+    //    先判断日志等级, 通过之后才会对参数求值; 低于 ZX_MIN_LEVEL 的等级在编译期被去除
+#define ZX_LOG_IF(level, fmt, ...)                                                    \
+    logIf(std::integral_constant<zx::LogLevel::value, zx::LogLevel::value::level>(), \
+          [&](zx::Logger &zx_logger_) { zx_logger_.ZX_LOG_##level(ZX_SITE(level, fmt), ##__VA_ARGS__); })
+#define ZX_LOG_DEBUG debug
+#define ZX_LOG_INFO info
+#define ZX_LOG_WARN warn
+#define ZX_LOG_ERROR error
+#define ZX_LOG_FATAL fatal
+
+#define debug(fmt, ...) ZX_LOG_IF(DEBUG, fmt, ##__VA_ARGS__)
+#define info(fmt, ...) ZX_LOG_IF(INFO, fmt, ##__VA_ARGS__)
+#define warn(fmt, ...) ZX_LOG_IF(WARN, fmt, ##__VA_ARGS__)
+#define error(fmt, ...) ZX_LOG_IF(ERROR, fmt, ##__VA_ARGS__)
+#define fatal(fmt, ...) ZX_LOG_IF(FATAL, fmt, ##__VA_ARGS__)
 
     // 3. 提供宏函数, 直接通过默认日志器进行日志的标准输出打印  --> 无需获取日志器了
-#define DEBUG(fmt, ...) zx::rootLogger()->debug(fmt, ##__VA_ARGS__)
-#define INFO(fmt, ...) zx::rootLogger()->info(fmt, ##__VA_ARGS__)
-#define WARN(fmt, ...) zx::rootLogger()->warn(fmt, ##__VA_ARGS__)
-#define ERROR(fmt, ...) zx::rootLogger()->error(fmt, ##__VA_ARGS__)
-#define FATAL(fmt, ...) zx::rootLogger()->fatal(fmt, ##__VA_ARGS__)
+#define DEBUG(fmt, ...) zx::rootLoggerPtr()->debug(fmt, ##__VA_ARGS__)
+#define INFO(fmt, ...) zx::rootLoggerPtr()->info(fmt, ##__VA_ARGS__)
+#define WARN(fmt, ...) zx::rootLoggerPtr()->warn(fmt, ##__VA_ARGS__)
+#define ERROR(fmt, ...) zx::rootLoggerPtr()->error(fmt, ##__VA_ARGS__)
+#define FATAL(fmt, ...) zx::rootLoggerPtr()->fatal(fmt, ##__VA_ARGS__)
 
 } // namespace zx
 
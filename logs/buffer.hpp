@@ -4,17 +4,229 @@
 
 #ifndef __M_BUFFER_H__
 #define __M_BUFFER_H__
-#include "logger.hpp"
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include "util.hpp"
+#include "level.hpp"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 namespace zx
 {
 #define DEFAULT_BUFFER_SIZE (1 * 1024 * 1024)
 #define THRESHOLD_BUFFER_SIZE (8 * 1024 * 1024)
 #define INCREMENT_BUFFER_SIZE (1 * 1024 * 1024)
+#define DEFAULT_RING_SIZE (2 * 1024 * 1024)
+#define DEFAULT_SPSC_SIZE (256 * 1024)
+#define DEFAULT_URGENT_SIZE (64 * 1024)
+#define MIN_RING_SIZE (64 * 1024)
+#define MIN_SPSC_SIZE (16 * 1024)
+    // 缓冲区内存的分配方式, 默认直接从堆上分配
+    struct MemPolicy
+    {
+        MemPolicy(bool huge_pages = false, bool prefault = false, bool lock = false)
+            : _huge_pages(huge_pages), _prefault(prefault), _lock(lock) {}
+
+        bool _huge_pages; // 使用大页: 先尝试 MAP_HUGETLB, 系统没有预留大页时退化为透明大页
+        bool _prefault;   // 分配时预先写入每个页面, 第一条日志不再触发缺页
+        bool _lock;       // mlock 锁定内存, 不会被换出; 超过 RLIMIT_MEMLOCK 时忽略
+        // 需要通过 mmap 分配
+        bool mapped() const { return _huge_pages || _prefault || _lock; }
+    };
+
+    namespace detail
+    {
+        const size_t SMALL_PAGE_SIZE = 4096;
+        const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        // 按分配方式对齐后的实际容量
+        inline size_t blockSize(size_t size, const MemPolicy &policy)
+        {
+            if (!policy.mapped())
+                return size;
+            size_t page = policy._huge_pages ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE;
+            return (std::max<size_t>(size, 1) + page - 1) / page * page;
+        }
+
+        // 分配 size 字节清零的内存, size 需要先经过 blockSize 对齐
+        inline char *allocBlock(size_t size, const MemPolicy &policy)
+        {
+            char *p = nullptr;
+#ifdef __linux__
+            if (policy.mapped())
+            {
+                void *m = MAP_FAILED;
+                int prot = PROT_READ | PROT_WRITE, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+                if (policy._huge_pages)
+                    m = mmap(nullptr, size, prot, flags | MAP_HUGETLB, -1, 0);
+                if (m == MAP_FAILED)
+                {
+                    m = mmap(nullptr, size, prot, flags, -1, 0);
+                    if (m == MAP_FAILED)
+                        throw std::bad_alloc();
+                    if (policy._huge_pages)
+                        madvise(m, size, MADV_HUGEPAGE);
+                }
+                p = (char *)m;
+                if (policy._lock)
+                    mlock(p, size);
+            }
+            else
+#endif
+            {
+                p = (char *)calloc(std::max<size_t>(size, 1), 1);
+                if (p == nullptr)
+                    throw std::bad_alloc();
+            }
+            // 每个页面写一次, 让内核在这里而不是在生产者线程中分配物理页
+            if (policy._prefault)
+            {
+                volatile char *v = p;
+                for (size_t i = 0; i < size; i += SMALL_PAGE_SIZE)
+                    v[i] = 0;
+            }
+            return p;
+        }
+
+        inline void freeBlock(char *p, size_t size, const MemPolicy &policy)
+        {
+            if (p == nullptr)
+                return;
+#ifdef __linux__
+            if (policy.mapped())
+            {
+                munmap(p, size);
+                return;
+            }
+#endif
+            free(p);
+        }
+    } // namespace detail
+
+    /*
+        进程内所有日志缓冲区共享的内存预算
+            1. 缓冲区的容量都从预算中申请, 释放内存时归还
+            2. 预算用完之后, 非安全模式的生产缓冲区不再扩容, 按溢出策略处理
+    */
+    class MemoryBudget
+    {
+    public:
+        static MemoryBudget &getInstance()
+        {
+            static MemoryBudget budget;
+            return budget;
+        }
+
+        // 预算上限, 字节; 0 表示不限制
+        void setLimit(size_t limit) { _limit.store(limit, std::memory_order_relaxed); }
+        size_t limit() { return _limit.load(std::memory_order_relaxed); }
+        // 当前所有缓冲区占用的容量
+        size_t used() { return _used.load(std::memory_order_relaxed); }
+
+        // 不超过上限时申请 n 字节
+        bool tryCharge(size_t n)
+        {
+            size_t limit = _limit.load(std::memory_order_relaxed);
+            size_t used = _used.load(std::memory_order_relaxed);
+            do
+            {
+                if (limit > 0 && used + n > limit)
+                    return false;
+            } while (!_used.compare_exchange_weak(used, used + n, std::memory_order_relaxed));
+            return true;
+        }
+        // 必须满足的申请(缓冲区的初始容量/单条超大日志), 允许超过上限
+        void charge(size_t n) { _used.fetch_add(n, std::memory_order_relaxed); }
+        void release(size_t n) { _used.fetch_sub(n, std::memory_order_relaxed); }
+
+    private:
+        MemoryBudget() : _limit(0), _used(0) {}
+
+        std::atomic<size_t> _limit;
+        std::atomic<size_t> _used;
+    };
+
+    /*
+        大日志的独立存储, 带引用计数
+            1. 超过阈值的日志不拷贝进异步缓冲区, 缓冲区中只保存指向它的描述符
+            2. 最后一个持有者调用 unref 时释放, 需要在落地之后继续持有的一方先调用 ref
+    */
+    class Slice
+    {
+    public:
+        // 创建容量为 capacity 的切片, 调用者持有一个引用
+        static Slice *create(size_t capacity)
+        {
+            void *p = malloc(sizeof(Slice) + capacity);
+            if (p == nullptr)
+                throw std::bad_alloc();
+            MemoryBudget::getInstance().charge(capacity);
+            return new (p) Slice(capacity);
+        }
+
+        char *data() { return reinterpret_cast<char *>(this + 1); }
+        size_t size() const { return _size; }
+        size_t capacity() const { return _capacity; }
+        void resize(size_t size)
+        {
+            assert(size <= _capacity);
+            _size = size;
+        }
+
+        void ref() { _refs.fetch_add(1, std::memory_order_relaxed); }
+        void unref()
+        {
+            if (_refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            MemoryBudget::getInstance().release(_capacity);
+            this->~Slice();
+            free(this);
+        }
+
+    private:
+        Slice(size_t capacity) : _refs(1), _size(0), _capacity(capacity) {}
+
+        std::atomic<uint32_t> _refs;
+        size_t _size;
+        size_t _capacity;
+    };
+
+    // 切片在缓冲区数据中的位置: 在可读数据的第 _off 字节之前输出
+    struct SliceMark
+    {
+        size_t _off;
+        Slice *_slice;
+    };
+
     class Buffer
     {
     public:
-        Buffer() : _buffer(DEFAULT_BUFFER_SIZE), _reader_idx(0), _write_idx(0) {};
+        Buffer(size_t size = DEFAULT_BUFFER_SIZE, const MemPolicy &policy = MemPolicy())
+            : _buffer(nullptr), _capacity(0), _base(detail::blockSize(size, policy)),
+              _reader_idx(0), _write_idx(0), _busy_at(0), _policy(policy), _slice_bytes(0),
+              _max_level(LogLevel::value::UNKNOW)
+        {
+            resize(_base);
+            MemoryBudget::getInstance().charge(_capacity);
+        }
+        ~Buffer()
+        {
+            releaseSlices();
+            MemoryBudget::getInstance().release(_capacity);
+            detail::freeBlock(_buffer, _capacity, _policy);
+        }
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
         // 向缓冲区写入数据
         void push(const char *data, size_t len)
         {
@@ -29,21 +241,47 @@ namespace zx
             //     return;
             ensureEnoughSize(len);
             // 将数据拷贝进缓冲区
-            std::copy(data, data + len, &_buffer[_write_idx]);
+            memcpy(_buffer + _write_idx, data, len);
             // 将当前写入位置向后偏移
             moveWriter(len);
         }
 
+        // 追加一个切片的描述符, 接管调用者持有的引用; 切片的数据不占用缓冲区的空间
+        void pushSlice(Slice *slice)
+        {
+            SliceMark mark = {readAbleSize(), slice};
+            _slices.push_back(mark);
+            _slice_bytes += slice->size();
+        }
+
+        // 按顺序排列的切片描述符
+        const std::vector<SliceMark> &slices() { return _slices; }
+
+        // 待处理的数据总长度, 包含切片
+        size_t pendingSize() { return readAbleSize() + _slice_bytes; }
+
+        // 保证有 len 字节的可写空间, 扩容的部分需要从内存预算中申请, 预算不足时返回 false
+        bool tryReserve(size_t len)
+        {
+            if (len <= writeAbleSize())
+                return true;
+            size_t new_size = growSize(len);
+            if (!MemoryBudget::getInstance().tryCharge(new_size - _capacity))
+                return false;
+            resize(new_size);
+            return true;
+        }
+
         size_t writeAbleSize()
         {
             // 该接口仅对固定缓冲区大小提供
-            return (_buffer.size() - _write_idx);
+            return (_capacity - _write_idx);
         }
 
         // 返回可读数据的起始地址
         const char *begin()
         {
-            return &_buffer[_reader_idx];
+            return _buffer + _reader_idx;
         }
 
         // 返回可读数据的长度
@@ -59,48 +297,595 @@ namespace zx
             _reader_idx += len;
         }
 
-        // 重置读写位置
-        void reset() { _write_idx = _reader_idx = 0; }
+        // 重置读写位置; 本轮用到了超出初始容量的空间时, 记录下时间供 shrink 判断空闲
+        void reset()
+        {
+            if (_write_idx > _base)
+                _busy_at = util::Date::monoNs();
+            _write_idx = _reader_idx = 0;
+            releaseSlices();
+            _max_level = LogLevel::value::UNKNOW;
+        }
+
+        // 扩容之后超过 idle_ns 没有再用到超出初始容量的空间, 则缩回初始容量
+        //  返回 0 表示没有可以归还的内存, 否则返回还需要空闲多久才能缩容
+        uint64_t shrink(uint64_t idle_ns)
+        {
+            if (_capacity <= _base || !empty())
+                return 0;
+            uint64_t now = util::Date::monoNs();
+            if (now - _busy_at < idle_ns)
+                return _busy_at + idle_ns - now;
+            _reader_idx = _write_idx = 0;
+            resize(_base);
+            return 0;
+        }
 
         // 对Buffer实现交换操作
         void swap(Buffer &buffer)
         {
-            _buffer.swap(buffer._buffer);
+            std::swap(_buffer, buffer._buffer);
+            std::swap(_capacity, buffer._capacity);
+            std::swap(_base, buffer._base);
             std::swap(_reader_idx, buffer._reader_idx);
             std::swap(_write_idx, buffer._write_idx);
+            std::swap(_busy_at, buffer._busy_at);
+            std::swap(_policy, buffer._policy);
+            _slices.swap(buffer._slices);
+            std::swap(_slice_bytes, buffer._slice_bytes);
+            std::swap(_max_level, buffer._max_level);
+        }
+
+        // 记录写入的日志等级, 落地方向据此决定是否需要持久化
+        void raiseLevel(LogLevel::value level)
+        {
+            if (level > _max_level)
+                _max_level = level;
         }
+        // 缓冲区中日志的最高等级
+        LogLevel::value maxLevel() const { return _max_level; }
 
         // 判断缓冲区是否为空S
         bool empty()
         {
-            return (_reader_idx == _write_idx);
+            return (_reader_idx == _write_idx) && _slices.empty();
         }
 
     private:
+        void releaseSlices()
+        {
+            for (auto &mark : _slices)
+                mark._slice->unref();
+            _slices.clear();
+            _slice_bytes = 0;
+        }
+
         // 对写指针进行向后偏移的操作
         void moveWriter(size_t len)
         {
-            assert((len + _write_idx) <= _buffer.size());
+            assert((len + _write_idx) <= _capacity);
             _write_idx += len;
         }
 
-        // 对空间进行扩容
+        size_t growSize(size_t len)
+        {
+            if (_capacity < THRESHOLD_BUFFER_SIZE)
+                return detail::blockSize(_capacity * 2 + len, _policy);
+            return detail::blockSize(_capacity + INCREMENT_BUFFER_SIZE + len, _policy);
+        }
+
+        // 对空间进行扩容, 超过预算也必须扩容
         void ensureEnoughSize(size_t len)
         {
             if (len <= writeAbleSize())
                 return;
-            size_t new_size = 0;
-            if (_buffer.size() < THRESHOLD_BUFFER_SIZE)
-                new_size = _buffer.size() * 2 + len;
+            size_t new_size = growSize(len);
+            MemoryBudget::getInstance().charge(new_size - _capacity);
+            resize(new_size);
+        }
+
+        // 调整容量, 堆上分配时新增的空间不做初始化; 预算的计费由调用者负责, 缩容时在这里归还
+        void resize(size_t size)
+        {
+            if (size < _capacity)
+                MemoryBudget::getInstance().release(_capacity - size);
+            char *p;
+            if (_policy.mapped())
+            {
+                // 映射的内存不能 realloc, 分配新的一块后拷贝已写入的数据
+                p = detail::allocBlock(size, _policy);
+                if (_buffer != nullptr)
+                {
+                    memcpy(p, _buffer, std::min(_write_idx, size));
+                    detail::freeBlock(_buffer, _capacity, _policy);
+                }
+            }
             else
-                new_size = _buffer.size() + INCREMENT_BUFFER_SIZE + len;
-            _buffer.resize(new_size);
+            {
+                p = (char *)realloc(_buffer, size > 0 ? size : 1);
+                if (p == nullptr)
+                    throw std::bad_alloc();
+            }
+            _buffer = p;
+            _capacity = size;
         }
 
     private:
-        std::vector<char> _buffer;
+        char *_buffer;
+        size_t _capacity;
+        size_t _base;       // 初始容量, 空闲时缩回这个大小
         size_t _reader_idx; // 当前刻度数据的指针
         size_t _write_idx;  // 当前可写数据的指针
+        uint64_t _busy_at;  // 最近一次用到超出初始容量的空间的时间
+        MemPolicy _policy;  // 内存的分配方式, 交换时随内存一起交换
+        std::vector<SliceMark> _slices; // 大日志的描述符
+        size_t _slice_bytes;            // 所有切片的数据长度
+        LogLevel::value _max_level;     // 缓冲区中日志的最高等级
+    };
+
+    namespace detail
+    {
+        // 环形缓冲区中的记录按 8 字节对齐, 容量取 2 的幂
+        inline size_t ringAlign(size_t len) { return (len + 7) & ~(size_t)7; }
+        inline size_t ringCapacity(size_t len)
+        {
+            size_t cap = 64;
+            while (cap < len)
+                cap <<= 1;
+            return cap;
+        }
+
+        // 从内存预算中为环形缓冲区申请容量, 返回实际的容量(仍是 2 的幂)
+        //  预算不足时容量逐次减半, 不低于 min; min 也超出预算时, must 为真则超额申请 min, 否则返回 0
+        inline size_t chargeRing(size_t capacity, size_t min, const MemPolicy &policy, bool must)
+        {
+            size_t cap = blockSize(ringCapacity(capacity), policy);
+            size_t floor = std::min(cap, blockSize(ringCapacity(min), policy));
+            MemoryBudget &budget = MemoryBudget::getInstance();
+            for (; cap > floor; cap >>= 1)
+                if (budget.tryCharge(cap))
+                    return cap;
+            if (budget.tryCharge(cap))
+                return cap;
+            if (!must)
+                return 0;
+            budget.charge(cap);
+            return cap;
+        }
+
+        // 固定大小的一块内存, 供环形缓冲区使用; size 已经由 chargeRing 从内存预算中申请, 释放时归还
+        class PageBlock
+        {
+        public:
+            PageBlock(size_t size, const MemPolicy &policy) : _data(nullptr), _size(size), _policy(policy)
+            {
+                try
+                {
+                    _data = allocBlock(size, policy);
+                }
+                catch (...)
+                {
+                    MemoryBudget::getInstance().release(size);
+                    throw;
+                }
+            }
+            ~PageBlock()
+            {
+                freeBlock(_data, _size, _policy);
+                MemoryBudget::getInstance().release(_size);
+            }
+            PageBlock(const PageBlock &) = delete;
+            PageBlock &operator=(const PageBlock &) = delete;
+
+            char &operator[](size_t i) { return _data[i]; }
+
+        private:
+            char *_data;
+            size_t _size;
+            MemPolicy _policy;
+        };
+    } // namespace detail
+
+    /*
+        无锁的多生产者/单消费者环形缓冲区
+            1. 生产者通过原子 fetch_add 预留空间, 在预留的位置直接写入, 最后发布记录头
+            2. 消费者按顺序读取已发布的记录, 读完后清零并释放空间
+        记录布局: [uint32_t 状态字][uint32_t 数据长度][数据...], 按 8 字节对齐
+            状态字 --> 0 表示尚未发布, 否则为记录占用的总长度; 最高位表示填充记录(跨越缓冲区末尾, 或被放弃的预留)
+                次高位表示记录中保存的是切片指针, 其后 3 位为日志等级
+        缓冲区中不属于已发布记录的字节始终为 0, 这样消费者读到 0 就知道记录还没有写完
+    */
+    class RingBuffer
+    {
+    public:
+        // 按页对齐后容量仍然是 2 的幂; 内存预算不足时容量减半, 最小为 min_capacity, 预算连它也放不下时超额申请
+        RingBuffer(size_t capacity = DEFAULT_RING_SIZE, const MemPolicy &policy = MemPolicy(), size_t min_capacity = MIN_RING_SIZE)
+            : _capacity(detail::chargeRing(capacity, min_capacity, policy, true)),
+              _buffer(_capacity, policy), _head(0), _tail(0)
+        {
+            // 状态字的高位用于标志与日志等级
+            assert(_capacity <= LEN_MASK);
+        }
+
+        // 生产者写入一条记录, 空间不足时等待消费者释放; 记录超过缓冲区容量时返回 false
+        // 每发布一条记录(包括填充记录)都会调用一次 published(该记录之前待消费的字节数), 用于唤醒消费者
+        // flags 为 levelFlags 与 SLICE_FLAG 的组合; 有 SLICE_FLAG 时 data 是切片指针, 消费者将其作为切片追加到 out 中
+        template <typename F>
+        bool push(const char *data, size_t len, const F &published, uint32_t flags = 0)
+        {
+            uint64_t pos;
+            char *p = reserve(len, pos, published);
+            if (p == nullptr)
+                return false;
+            memcpy(p, data, len);
+            commit(pos, len, len, published, flags);
+            return true;
+        }
+
+        // 预留一条最多 len 字节的记录, 返回数据区的地址, 生产者直接在其中写入; 超过缓冲区容量时返回空
+        //  pos 为记录的位置, 之后必须通过 commit 发布或 cancel 放弃
+        template <typename F>
+        char *reserve(size_t len, uint64_t &pos, const F &published)
+        {
+            size_t need = detail::ringAlign(HEADER_SIZE + len);
+            if (need > _capacity)
+                return nullptr;
+            while (true)
+            {
+                pos = _tail.fetch_add(need, std::memory_order_relaxed);
+                // 等待消费者释放出 [pos, pos + need) 的空间
+                uint64_t head;
+                while (pos + need - (head = _head.load(std::memory_order_acquire)) > _capacity)
+                    std::this_thread::yield();
+                size_t off = pos & (_capacity - 1);
+                if (off + need > _capacity)
+                {
+                    // 跨越缓冲区末尾, 整段作为填充记录, 重新预留
+                    publish(off, need | PAD_FLAG);
+                    published(pos - head);
+                    continue;
+                }
+                return &_buffer[off + HEADER_SIZE];
+            }
+        }
+
+        // 发布 reserve 预留的记录, reserved 为预留的长度, len 为实际写入的长度
+        template <typename F>
+        void commit(uint64_t pos, size_t reserved, size_t len, const F &published, uint32_t flags = 0)
+        {
+            assert(len <= reserved);
+            size_t off = pos & (_capacity - 1);
+            uint32_t n = (uint32_t)len;
+            memcpy(&_buffer[off + sizeof(uint32_t)], &n, sizeof(n));
+            publish(off, detail::ringAlign(HEADER_SIZE + reserved) | flags);
+            published(pos - _head.load(std::memory_order_relaxed));
+        }
+
+        // 放弃 reserve 预留的记录: 空间已经被占用, 只能作为填充记录发布
+        template <typename F>
+        void cancel(uint64_t pos, size_t reserved, const F &published)
+        {
+            size_t off = pos & (_capacity - 1);
+            publish(off, detail::ringAlign(HEADER_SIZE + reserved) | PAD_FLAG);
+            published(pos - _head.load(std::memory_order_relaxed));
+        }
+
+        // 消费者将已发布的记录数据依次追加到 out 中, 直到遇到未发布的记录, out 空间不足或超过 limit 字节
+        // 返回本次读取的字节数
+        size_t popTo(Buffer &out, size_t limit = SIZE_MAX)
+        {
+            size_t total = 0;
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            while (true)
+            {
+                size_t off = head & (_capacity - 1);
+                uint32_t state = __atomic_load_n(stateWord(off), __ATOMIC_ACQUIRE);
+                if (state == 0)
+                    break;
+                size_t need = state & LEN_MASK;
+                if (state & SLICE_FLAG)
+                {
+                    Slice *slice;
+                    memcpy(&slice, &_buffer[off + HEADER_SIZE], sizeof(slice));
+                    out.pushSlice(slice);
+                    total += slice->size();
+                }
+                else if ((state & PAD_FLAG) == 0)
+                {
+                    uint32_t n;
+                    memcpy(&n, &_buffer[off + sizeof(uint32_t)], sizeof(n));
+                    if (!out.empty() && (n > out.writeAbleSize() || out.readAbleSize() + n > limit))
+                        break;
+                    out.push(&_buffer[off + HEADER_SIZE], n);
+                    total += n;
+                }
+                if ((state & PAD_FLAG) == 0)
+                    out.raiseLevel(static_cast<LogLevel::value>((state >> LEVEL_SHIFT) & 0x7));
+                // 清零后释放空间, 保证未发布的位置读到的状态字总是 0
+                size_t first = std::min(need, _capacity - off);
+                memset(&_buffer[off], 0, first);
+                memset(&_buffer[0], 0, need - first);
+                head += need;
+                _head.store(head, std::memory_order_release);
+            }
+            return total;
+        }
+
+        // 是否有已发布的记录可读
+        bool readable()
+        {
+            size_t off = _head.load(std::memory_order_relaxed) & (_capacity - 1);
+            return __atomic_load_n(stateWord(off), __ATOMIC_ACQUIRE) != 0;
+        }
+
+        // 所有预留的空间都已经被消费
+        bool empty()
+        {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+
+        // 已预留还未消费的字节数, 包含记录头与填充
+        size_t pending()
+        {
+            return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+        }
+
+        // 当前是否还能放下 len 字节的记录 --> 多个生产者同时判断时只是近似值
+        bool hasSpace(size_t len)
+        {
+            size_t need = detail::ringAlign(HEADER_SIZE + len);
+            return need <= _capacity && pending() + need <= _capacity;
+        }
+
+        // 记录是否可能放得下 --> 超过缓冲区容量的记录永远放不下
+        bool canHold(size_t len) const { return detail::ringAlign(HEADER_SIZE + len) <= _capacity; }
+
+        static const uint32_t SLICE_FLAG = 0x40000000u; // 记录的数据是切片指针
+        // 记录的日志等级
+        static uint32_t levelFlags(LogLevel::value level) { return (uint32_t)level << LEVEL_SHIFT; }
+
+    private:
+        static const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+        static const uint32_t PAD_FLAG = 0x80000000u;
+        static const uint32_t LEVEL_SHIFT = 27;
+        static const uint32_t LEN_MASK = (1u << LEVEL_SHIFT) - 1;
+
+        uint32_t *stateWord(size_t off) { return reinterpret_cast<uint32_t *>(&_buffer[off]); }
+
+        void publish(size_t off, uint32_t state)
+        {
+            __atomic_store_n(stateWord(off), state, __ATOMIC_RELEASE);
+        }
+
+    private:
+        size_t _capacity; // 2 的幂, 且是 8 的倍数
+        detail::PageBlock _buffer;
+        // 读写位置分别独占缓存行, 避免生产者与消费者之间的伪共享
+        alignas(64) std::atomic<uint64_t> _head; // 消费者已释放的位置
+        alignas(64) std::atomic<uint64_t> _tail; // 生产者已预留的位置
+    };
+
+    /*
+        单生产者/单消费者环形缓冲区, 每个生产者线程独占一个
+            1. 写位置只有所属线程修改, 读位置只有工作线程修改, 不需要任何原子读改写操作
+            2. 所属线程退出或工作器停止时被关闭, 工作线程读完剩余数据后将其移除
+        记录布局: [uint32_t 数据长度][uint32_t 标志与日志等级][uint64_t 时间戳][数据...], 按 8 字节对齐
+            长度为 PAD_LEN 表示从该位置到缓冲区末尾是填充
+            时间戳由生产者给出, 工作线程据此对多个队列的记录进行归并
+            所属线程通过 hold 公布正在写入(可能在等待空间)的记录的时间戳, 队列为空时工作线程以它作为该队列的下限
+    */
+    class SpscRing
+    {
+    public:
+        using ptr = std::shared_ptr<SpscRing>;
+
+        // 内存预算不足时容量减半, 最小为 min_capacity; 预算连它也放不下时返回空, 不创建队列
+        static ptr create(size_t capacity = DEFAULT_SPSC_SIZE, const MemPolicy &policy = MemPolicy(),
+                          size_t min_capacity = MIN_SPSC_SIZE)
+        {
+            size_t cap = detail::chargeRing(capacity, min_capacity, policy, false);
+            if (cap == 0)
+                return nullptr;
+            return ptr(new SpscRing(cap, policy));
+        }
+
+        // 读写位置按缓存行对齐, C++11 的 new 不保证这样的对齐
+        static void *operator new(size_t size)
+        {
+            void *p = nullptr;
+            if (posix_memalign(&p, alignof(SpscRing), size) != 0)
+                throw std::bad_alloc();
+            return p;
+        }
+        static void operator delete(void *p) { free(p); }
+
+        // 所属线程写入一条记录, 空间不足时等待工作线程读取; 记录超过缓冲区容量时返回 false
+        // flags 为 levelFlags 与 SLICE_FLAG 的组合; 有 SLICE_FLAG 时 data 是切片指针
+        template <typename F>
+        bool push(const char *data, size_t len, uint64_t stamp, const F &published, uint32_t flags = 0)
+        {
+            uint64_t pos;
+            char *p = reserve(len, pos);
+            if (p == nullptr)
+                return false;
+            memcpy(p, data, len);
+            commit(pos, len, stamp, published, flags);
+            return true;
+        }
+
+        // 预留一条最多 len 字节的记录, 返回数据区的地址; 超过缓冲区容量时返回空
+        //  pos 为记录的位置, 之后通过 commit 发布; 不发布时什么都不用做
+        char *reserve(size_t len, uint64_t &pos)
+        {
+            size_t need = detail::ringAlign(HEADER_SIZE + len);
+            if (need > _capacity)
+                return nullptr;
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            size_t off = tail & (_capacity - 1);
+            size_t pad = off + need > _capacity ? _capacity - off : 0;
+            if (tail + pad + need - _head.load(std::memory_order_acquire) > _capacity)
+            {
+                // 与工作线程读取 held 之前的屏障配对: 要么工作线程看到 hold 的时间戳, 要么这里看到释放的空间
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                while (tail + pad + need - _head.load(std::memory_order_acquire) > _capacity)
+                    std::this_thread::yield();
+            }
+            if (pad > 0)
+            {
+                // 跨越缓冲区末尾, 剩余部分作为填充, 从头开始写
+                uint32_t n = PAD_LEN;
+                memcpy(&_buffer[off], &n, sizeof(n));
+            }
+            pos = tail + pad;
+            return &_buffer[(pos & (_capacity - 1)) + HEADER_SIZE];
+        }
+
+        // 发布 reserve 预留的记录, len 为实际写入的长度
+        template <typename F>
+        void commit(uint64_t pos, size_t len, uint64_t stamp, const F &published, uint32_t flags = 0)
+        {
+            size_t off = pos & (_capacity - 1);
+            uint32_t n = (uint32_t)len;
+            memcpy(&_buffer[off], &n, sizeof(n));
+            memcpy(&_buffer[off + FLAGS_OFFSET], &flags, sizeof(flags));
+            memcpy(&_buffer[off + STAMP_OFFSET], &stamp, sizeof(stamp));
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            _tail.store(pos + detail::ringAlign(HEADER_SIZE + len), std::memory_order_release);
+            // 记录已经可见, 在 _tail 之后清除, 工作线程先读 held 再读 _tail
+            if (_held.load(std::memory_order_relaxed) != 0)
+                _held.store(0, std::memory_order_release);
+            published(tail - _head.load(std::memory_order_relaxed));
+        }
+
+        // 所属线程调用: 公布即将写入的记录的时间戳, 写入完成(commit)或调用 hold(0) 之前, 之后的记录都不会早于它
+        void hold(uint64_t stamp) { _held.store(stamp, std::memory_order_relaxed); }
+
+        // 工作线程调用: 所属线程正在写入的记录的时间戳, 0 表示没有; 需要在 front 之前调用
+        uint64_t held()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return _held.load(std::memory_order_acquire);
+        }
+
+        // 工作线程将已写入的记录数据依次追加到 out 中, 直到读完, out 空间不足或超过 limit 字节
+        size_t popTo(Buffer &out, size_t limit = SIZE_MAX)
+        {
+            size_t total = 0;
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            uint64_t tail = _tail.load(std::memory_order_acquire);
+            while (head < tail)
+            {
+                size_t off = head & (_capacity - 1);
+                uint32_t n;
+                memcpy(&n, &_buffer[off], sizeof(n));
+                if (n == PAD_LEN)
+                {
+                    head += _capacity - off;
+                    continue;
+                }
+                uint32_t flags;
+                memcpy(&flags, &_buffer[off + FLAGS_OFFSET], sizeof(flags));
+                out.raiseLevel(flagsLevel(flags));
+                if (flags & SLICE_FLAG)
+                {
+                    Slice *slice;
+                    memcpy(&slice, &_buffer[off + HEADER_SIZE], sizeof(slice));
+                    out.pushSlice(slice);
+                    total += slice->size();
+                }
+                else
+                {
+                    if (!out.empty() && (n > out.writeAbleSize() || out.readAbleSize() + n > limit))
+                        break;
+                    out.push(&_buffer[off + HEADER_SIZE], n);
+                    total += n;
+                }
+                head += detail::ringAlign(HEADER_SIZE + n);
+            }
+            _head.store(head, std::memory_order_release);
+            return total;
+        }
+
+        // 查看队首记录而不移除, 没有数据时返回 false
+        bool front(const char *&data, uint32_t &len, uint64_t &stamp, uint32_t &flags)
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            uint64_t tail = _tail.load(std::memory_order_acquire);
+            if (head == tail)
+                return false;
+            size_t off = head & (_capacity - 1);
+            memcpy(&len, &_buffer[off], sizeof(len));
+            if (len == PAD_LEN)
+            {
+                // 填充之后一定还有一条记录
+                head += _capacity - off;
+                _head.store(head, std::memory_order_release);
+                off = 0;
+                memcpy(&len, &_buffer[off], sizeof(len));
+            }
+            memcpy(&flags, &_buffer[off + FLAGS_OFFSET], sizeof(flags));
+            memcpy(&stamp, &_buffer[off + STAMP_OFFSET], sizeof(stamp));
+            data = &_buffer[off + HEADER_SIZE];
+            return true;
+        }
+
+        // 移除 front 返回的队首记录
+        void pop(uint32_t len)
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            _head.store(head + detail::ringAlign(HEADER_SIZE + len), std::memory_order_release);
+        }
+
+        bool readable()
+        {
+            return _head.load(std::memory_order_relaxed) != _tail.load(std::memory_order_acquire);
+        }
+
+        // 已写入还未读取的字节数, 包含记录头与填充
+        size_t pending()
+        {
+            return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_relaxed);
+        }
+
+        // 所属线程调用: 当前是否能放下 len 字节的记录, 包括跨越末尾时需要的填充
+        bool hasSpace(size_t len)
+        {
+            size_t need = detail::ringAlign(HEADER_SIZE + len);
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            size_t off = tail & (_capacity - 1);
+            size_t pad = off + need > _capacity ? _capacity - off : 0;
+            return need <= _capacity && tail + pad + need - _head.load(std::memory_order_acquire) <= _capacity;
+        }
+
+        // 记录是否可能放得下 --> 超过缓冲区容量的记录永远放不下
+        bool canHold(size_t len) const { return detail::ringAlign(HEADER_SIZE + len) <= _capacity; }
+
+        void close() { _closed.store(true, std::memory_order_release); }
+        bool closed() { return _closed.load(std::memory_order_acquire); }
+
+        static const uint32_t SLICE_FLAG = 1; // 记录的数据是切片指针
+        // 记录的日志等级
+        static uint32_t levelFlags(LogLevel::value level) { return (uint32_t)level << 8; }
+        static LogLevel::value flagsLevel(uint32_t flags) { return static_cast<LogLevel::value>((flags >> 8) & 0xff); }
+
+    private:
+        // capacity 已经从内存预算中申请
+        SpscRing(size_t capacity, const MemPolicy &policy)
+            : _capacity(capacity), _buffer(_capacity, policy), _closed(false), _head(0), _tail(0), _held(0) {}
+
+    private:
+        static const size_t FLAGS_OFFSET = sizeof(uint32_t);
+        static const size_t STAMP_OFFSET = 2 * sizeof(uint32_t);
+        static const size_t HEADER_SIZE = STAMP_OFFSET + sizeof(uint64_t);
+        static const uint32_t PAD_LEN = 0xffffffffu;
+
+    private:
+        size_t _capacity; // 2 的幂, 且是 8 的倍数
+        detail::PageBlock _buffer;
+        std::atomic<bool> _closed;
+        alignas(64) std::atomic<uint64_t> _head; // 工作线程已读取的位置
+        alignas(64) std::atomic<uint64_t> _tail; // 所属线程已写入的位置
+        std::atomic<uint64_t> _held;             // 所属线程正在写入的记录的时间戳
     };
 } // namespace zx
 
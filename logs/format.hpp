@@ -6,6 +6,8 @@
 #include <memory>
 #include <sstream>
 #include <cassert>
+#include <cstring>
+#include <atomic>
 
 namespace zx
 {
@@ -14,7 +16,9 @@ namespace zx
     {
     public:
         using ptr = std::shared_ptr<FormatItem>;
-        virtual void format(std::ostream &out, const LogMsg &msg) = 0;
+        virtual void format(FmtBuffer &out, const LogMsg &msg) = 0;
+        // 格式化结果长度的上限, 用于在异步缓冲区中预留空间
+        virtual size_t sizeHint(const LogMsg &msg) const = 0;
     };
 
     // 派生格式化子项子类 --> 消息、等级、时间、文件名、行号、线程ID、日志器名、制表符、换行、其他
@@ -22,99 +26,251 @@ namespace zx
     class MsgFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << msg._payload;
+            out.append(msg._payload, msg._payload_len);
         }
+        size_t sizeHint(const LogMsg &msg) const override { return msg._payload_len; }
     };
 
     // 等级格式化子项子类
     class LevelFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << LogLevel::toString(msg._level);
+            out.append(LogLevel::toString(msg._site->_level));
         }
+        size_t sizeHint(const LogMsg &) const override { return 8; }
     };
 
+    // 按秒缓存的时间文本 --> 同一秒内只调用一次 localtime_r/strftime, 避免 glibc 时区锁让生产者线程串行
+    struct TimeCache
+    {
+        uint64_t _key;        // 时间格式化子项的编号, 区分不同的子项
+        time_t _sec;          // 缓存对应的秒
+        uint32_t _len;        // 日期文本长度
+        uint32_t _suffix_len; // 时区后缀长度
+        char _text[32];       // strftime 输出的日期文本
+        char _suffix[8];      // ISO-8601 的时区后缀 +08:00
+    };
+
+    // 线程局部的缓存表, 按键直接映射, 冲突时重新格式化即可
+    inline TimeCache &threadTimeCache(uint64_t key)
+    {
+        static thread_local TimeCache cache[8];
+        return cache[key % 8];
+    }
+
+    // 每个时间格式化子项的唯一编号, 从 1 开始
+    inline uint64_t nextTimeKey()
+    {
+        static std::atomic<uint64_t> key(0);
+        return ++key;
+    }
+
+    // key 由调用方保证唯一, 不能为 0
+    inline const TimeCache &cachedTime(uint64_t key, const char *fmt, time_t sec, bool utc, bool iso_offset)
+    {
+        TimeCache &c = threadTimeCache(key);
+        if (c._key == key && c._sec == sec)
+            return c;
+        struct tm t;
+        if (utc)
+            gmtime_r(&sec, &t);
+        else
+            localtime_r(&sec, &t);
+        c._len = (uint32_t)strftime(c._text, 31, fmt, &t);
+        c._suffix_len = 0;
+        if (iso_offset)
+        {
+            char z[8];
+            if (strftime(z, sizeof(z), "%z", &t) == 5)
+            {
+                memcpy(c._suffix, z, 3);
+                c._suffix[3] = ':';
+                memcpy(c._suffix + 4, z + 3, 2);
+                c._suffix_len = 6;
+            }
+        }
+        c._key = key;
+        c._sec = sec;
+        return c;
+    }
+
     // 时间格式化子项子类
     class TimeFormatItem : public FormatItem
     {
     public:
         // 构造函数
-        TimeFormatItem(const std::string &fmt = "%H:%M:%S") : _time_fmt(fmt) {}
-        void format(std::ostream &out, const LogMsg &msg) override
+        TimeFormatItem(const std::string &fmt = "%H:%M:%S") : _time_fmt(fmt), _key(nextTimeKey()) {}
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            struct tm t;
-            localtime_r(&msg._ctime, &t);
-            char tmp[32] = {0};
-            strftime(tmp, 31, _time_fmt.c_str(), &t);
-            out << tmp;
+            const TimeCache &c = cachedTime(_key, _time_fmt.c_str(), msg._ctime, false, false);
+            out.append(c._text, c._len);
         }
+        size_t sizeHint(const LogMsg &) const override { return 32; }
 
     private:
         std::string _time_fmt; // 时间子格式 %H:%M:%S
+        uint64_t _key;         // 时间缓存的键
     };
 
-    // 文件名格式化子项子类
+    // 定宽的十进制数字, 不足位数在前面补0
+    inline void appendDigits(FmtBuffer &out, uint32_t v, int width)
+    {
+        char *p = out.prepare(width);
+        for (int i = width - 1; i >= 0; i--)
+        {
+            p[i] = (char)('0' + v % 10);
+            v /= 10;
+        }
+        out.commit(width);
+    }
+
+    // 秒以下的时间, 截取纳秒的前 width 位
+    inline void appendSubSecond(FmtBuffer &out, uint32_t nsec, int width)
+    {
+        for (int i = width; i < 9; i++)
+            nsec /= 10;
+        appendDigits(out, nsec, width);
+    }
+
+    // 秒以下的时间格式化子项子类 --> 毫秒/微秒/纳秒
+    class SubSecondFormatItem : public FormatItem
+    {
+    public:
+        SubSecondFormatItem(int width) : _width(width) {}
+        void format(FmtBuffer &out, const LogMsg &msg) override
+        {
+            appendSubSecond(out, msg._nsec, _width);
+        }
+        size_t sizeHint(const LogMsg &) const override { return _width; }
+
+    private:
+        int _width; // 3 --> 毫秒, 6 --> 微秒, 9 --> 纳秒
+    };
+
+    // ISO-8601 时间, key 为时间缓存的键
+    inline void appendIsoTime(FmtBuffer &out, uint64_t key, const LogMsg &msg, bool utc)
+    {
+        const TimeCache &c = cachedTime(key, "%Y-%m-%dT%H:%M:%S", msg._ctime, utc, !utc);
+        out.append(c._text, c._len);
+        out.push_back('.');
+        appendDigits(out, msg._nsec / 1000000, 3);
+        if (utc)
+            out.push_back('Z');
+        else
+            out.append(c._suffix, c._suffix_len);
+    }
+
+    // ISO-8601 时间格式化子项子类 --> 2024-01-02T15:04:05.123+08:00 或 2024-01-02T07:04:05.123Z
+    class IsoTimeFormatItem : public FormatItem
+    {
+    public:
+        IsoTimeFormatItem(bool utc) : _utc(utc), _key(nextTimeKey()) {}
+        void format(FmtBuffer &out, const LogMsg &msg) override
+        {
+            appendIsoTime(out, _key, msg, _utc);
+        }
+        size_t sizeHint(const LogMsg &) const override { return 32; }
+
+    private:
+        bool _utc;
+        uint64_t _key; // 时间缓存的键
+    };
+
+    // 文件名格式化子项子类 --> 完整的源码路径 (__FILE__)
     class FileFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
+        {
+            out.append(msg._site->_file);
+        }
+        size_t sizeHint(const LogMsg &msg) const override { return strlen(msg._site->_file); }
+    };
+
+    // 不含目录的源码文件名格式化子项子类
+    class BasenameFormatItem : public FormatItem
+    {
+    public:
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << msg._file;
+            out.append(msg._site->_basename);
         }
+        size_t sizeHint(const LogMsg &msg) const override { return strlen(msg._site->_basename); }
     };
 
     // 行号格式化子项子类
     class LineFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << msg._line;
+            appendArg(out, msg._site->_line);
         }
+        size_t sizeHint(const LogMsg &) const override { return 24; }
     };
 
+    // 线程ID的输出
+    inline void appendThreadId(FmtBuffer &out, const std::thread::id &tid)
+    {
+        // libstdc++ 的 std::thread::id 只保存了 pthread_t, operator<< 输出的就是它的十进制值
+        if (sizeof(std::thread::id) == sizeof(unsigned long))
+        {
+            unsigned long id;
+            memcpy(&id, &tid, sizeof(id));
+            appendArg(out, id);
+            return;
+        }
+        std::ostringstream ss;
+        ss << tid;
+        out.append(ss.str());
+    }
+
     // 线程ID格式化子项子类
     class ThreadFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << msg._tid;
+            appendThreadId(out, msg._tid);
         }
+        size_t sizeHint(const LogMsg &) const override { return 24; }
     };
 
     // 日志器名格式化子项子类
     class LoggerFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << msg._logger;
+            out.append(msg._logger);
         }
+        size_t sizeHint(const LogMsg &msg) const override { return strlen(msg._logger); }
     };
 
     // 制表符格式化子项子类
     class TabFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << "\t";
+            out.push_back('\t');
         }
+        size_t sizeHint(const LogMsg &) const override { return 1; }
     };
 
     // 换行符格式化子项子类
     class NLineFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << "\n";
+            out.push_back('\n');
         }
+        size_t sizeHint(const LogMsg &) const override { return 1; }
     };
 
     // 其他格式化子项子类
@@ -122,27 +278,68 @@ namespace zx
     {
     public:
         OtherFormatItem(const std::string &str) : _str(str) {}
-        void format(std::ostream &out, const LogMsg &msg) override
+        void format(FmtBuffer &out, const LogMsg &msg) override
         {
-            out << _str;
+            out.append(_str);
         }
+        size_t sizeHint(const LogMsg &) const override { return _str.size(); }
 
     private:
         std::string _str;
     };
 
+    // 每个线程复用同一块日志行缓冲区
+    inline FmtBuffer &threadLineBuffer()
+    {
+        static thread_local FmtBuffer buf;
+        return buf;
+    }
+
     /*
         %d --> 表示日期, 包含子格式 {%H:%M:%S}
         %t --> 表示线程ID
         %c --> 表示日志器名称
-        %f --> 表示源码文件名
+        %f --> 表示源码文件路径 (__FILE__)
+        %s --> 表示源码文件名, 不含目录
         %l --> 表示行号
         %p --> 表示日志级别
         %T --> 表示制表符缩进
         %m --> 表示主体消息
         %n --> 表示换行
+        %e --> 表示毫秒 (3位)
+        %u --> 表示微秒 (6位)
+        %N --> 表示纳秒 (9位)
+        %D --> 表示 ISO-8601 本地时间, 精确到毫秒并带时区: 2024-01-02T15:04:05.123+08:00
+        %Z --> 表示 ISO-8601 UTC 时间, 精确到毫秒: 2024-01-02T07:04:05.123Z
+        解析时相邻的原始字符串/制表符/换行合并成一个子项, 同时编译为一个扁平的指令数组: 操作码 + 字符串池中的区间,
+        格式化时通过 switch 循环直接追加到缓冲区, 没有虚函数调用
     */
 
+    // 格式化指令的操作码
+    enum class FmtOp : uint8_t
+    {
+        LITERAL,   // 原始字符串, 对应字符串池中的区间
+        TIME,      // 时间, 子格式存放在字符串池中, 以 \0 结尾
+        SUBSEC,    // 秒以下的时间, _len 为位数
+        ISO_LOCAL, // ISO-8601 本地时间
+        ISO_UTC,   // ISO-8601 UTC 时间
+        THREAD,
+        LOGGER,
+        FILE,
+        BASENAME,
+        LINE,
+        LEVEL,
+        MSG
+    };
+
+    struct FmtInstr
+    {
+        FmtOp _op;
+        uint32_t _off; // 在字符串池中的起始位置
+        uint32_t _len; // 在字符串池中的长度
+        uint64_t _key; // 时间类指令的缓存键
+    };
+
     class Formatter
     {
     public:
@@ -150,8 +347,31 @@ namespace zx
         Formatter(const std::string &pattern = "[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n")
             : _pattern(pattern) { assert(parsePattern()); }
 
-        // 对msg进行格式化
-        void format(std::ostream &out, const LogMsg &msg)
+        // 针对指定日志器生成专用的格式化器: %c 直接替换为日志器名称, 并与相邻的原始字符串合并成一个子项
+        // 这样每条日志只需要格式化时间/线程/文件行号/等级/消息这些真正变化的部分
+        Formatter::ptr bindLogger(const std::string &logger_name) const
+        {
+            return Formatter::ptr(new Formatter(*this, logger_name));
+        }
+
+        // 对msg进行格式化, 追加到 out 中 --> out 可以是线程复用的缓冲区, 稳定后不再申请内存
+        void format(FmtBuffer &out, const LogMsg &msg)
+        {
+            // 原始字符串与消息最常见, 直接在循环中处理; 其余字段交给 formatField, 使循环保持短小
+            const char *pool = _pool.data();
+            for (const FmtInstr *ins = _program.data(), *end = ins + _program.size(); ins != end; ++ins)
+            {
+                if (ins->_op == FmtOp::LITERAL)
+                    out.append(pool + ins->_off, ins->_len);
+                else if (ins->_op == FmtOp::MSG)
+                    out.append(msg._payload, msg._payload_len);
+                else
+                    formatField(out, *ins, msg);
+            }
+        }
+
+        // 通过格式化子项逐个虚函数调用进行格式化, 与 format 的输出完全一致, 用于对照测试
+        void formatByItems(FmtBuffer &out, const LogMsg &msg)
         {
             for (auto &item : _items)
             {
@@ -159,14 +379,122 @@ namespace zx
             }
         }
 
+        // 格式化结果长度的上限, 用于在异步缓冲区中预留空间
+        size_t sizeHint(const LogMsg &msg) const
+        {
+            size_t n = 0;
+            for (const FmtInstr &ins : _program)
+            {
+                switch (ins._op)
+                {
+                case FmtOp::LITERAL:
+                case FmtOp::SUBSEC:
+                    n += ins._len;
+                    break;
+                case FmtOp::TIME:
+                case FmtOp::ISO_LOCAL:
+                case FmtOp::ISO_UTC:
+                    n += 32;
+                    break;
+                case FmtOp::THREAD:
+                case FmtOp::LINE:
+                    n += 24;
+                    break;
+                case FmtOp::LOGGER:
+                    n += strlen(msg._logger);
+                    break;
+                case FmtOp::FILE:
+                    n += strlen(msg._site->_file);
+                    break;
+                case FmtOp::BASENAME:
+                    n += strlen(msg._site->_basename);
+                    break;
+                case FmtOp::LEVEL:
+                    n += 8;
+                    break;
+                case FmtOp::MSG:
+                    n += msg._payload_len;
+                    break;
+                }
+            }
+            return n;
+        }
+
+        // 与 sizeHint 的结果一致, 用于对照测试
+        size_t sizeHintByItems(const LogMsg &msg) const
+        {
+            size_t n = 0;
+            for (auto &item : _items)
+            {
+                n += item->sizeHint(msg);
+            }
+            return n;
+        }
+
+        void format(std::ostream &out, const LogMsg &msg)
+        {
+            FmtBuffer buf;
+            format(buf, msg);
+            out.write(buf.data(), buf.size());
+        }
+
         std::string format(const LogMsg &msg)
         {
-            std::stringstream ss;
-            format(ss, msg);
-            return ss.str();
+            FmtBuffer buf;
+            format(buf, msg);
+            return std::string(buf.data(), buf.size());
         }
 
     private:
+        Formatter(const Formatter &other, const std::string &logger_name)
+            : _pattern(other._pattern), _order(other._order)
+        {
+            buildItems(&logger_name);
+        }
+
+        // 执行原始字符串与消息以外的指令
+        void formatField(FmtBuffer &out, const FmtInstr &ins, const LogMsg &msg) const
+        {
+            switch (ins._op)
+            {
+            case FmtOp::TIME:
+            {
+                const TimeCache &c = cachedTime(ins._key, _pool.data() + ins._off, msg._ctime, false, false);
+                out.append(c._text, c._len);
+                break;
+            }
+            case FmtOp::SUBSEC:
+                appendSubSecond(out, msg._nsec, ins._len);
+                break;
+            case FmtOp::ISO_LOCAL:
+                appendIsoTime(out, ins._key, msg, false);
+                break;
+            case FmtOp::ISO_UTC:
+                appendIsoTime(out, ins._key, msg, true);
+                break;
+            case FmtOp::THREAD:
+                appendThreadId(out, msg._tid);
+                break;
+            case FmtOp::LOGGER:
+                out.append(msg._logger);
+                break;
+            case FmtOp::FILE:
+                out.append(msg._site->_file);
+                break;
+            case FmtOp::BASENAME:
+                out.append(msg._site->_basename);
+                break;
+            case FmtOp::LINE:
+                appendArg(out, msg._site->_line);
+                break;
+            case FmtOp::LEVEL:
+                out.append(LogLevel::toString(msg._site->_level));
+                break;
+            default:
+                break;
+            }
+        }
+
         // 对格式化规则字符串进行解析
         bool parsePattern()
         {
@@ -226,11 +554,91 @@ namespace zx
                 val.clear();
             }
             // 2. 根据解析得到的数据初始化格式化子项数组成员
-            for (auto &it : fmt_order)
+            _order.swap(fmt_order);
+            buildItems(nullptr);
+            return true;
+        }
+
+        // 创建格式化子项并编译为指令数组, 相邻的原始字符串/制表符/换行合并成一个子项;
+        // logger_name 不为空时 %c 也作为原始字符串合并
+        void buildItems(const std::string *logger_name)
+        {
+            std::string literal;
+            for (auto &it : _order)
             {
-                _items.push_back(createItem(it.first, it.second));
+                if (it.first == "")
+                    literal.append(it.second);
+                else if (it.first == "T")
+                    literal.push_back('\t');
+                else if (it.first == "n")
+                    literal.push_back('\n');
+                else if (it.first == "c" && logger_name)
+                    literal.append(*logger_name);
+                else
+                {
+                    if (literal.empty() == false)
+                    {
+                        _items.push_back(std::make_shared<OtherFormatItem>(literal));
+                        emitLiteral(literal);
+                        literal.clear();
+                    }
+                    _items.push_back(createItem(it.first, it.second));
+                    compileItem(it.first, it.second);
+                }
             }
-            return true;
+            if (literal.empty() == false)
+            {
+                _items.push_back(std::make_shared<OtherFormatItem>(literal));
+                emitLiteral(literal);
+            }
+        }
+
+        // 追加一条原始字符串指令, 相邻的原始字符串在 buildItems 中已经合并
+        void emitLiteral(const std::string &str)
+        {
+            emit(FmtOp::LITERAL, str.size(), 0);
+            _pool.append(str);
+        }
+
+        void emit(FmtOp op, size_t len = 0, uint64_t key = 0)
+        {
+            FmtInstr ins = {op, (uint32_t)_pool.size(), (uint32_t)len, key};
+            _program.push_back(ins);
+        }
+
+        // 根据不同的格式化字符编译出对应的指令, 与 createItem 一一对应
+        void compileItem(const std::string &key, const std::string &val)
+        {
+            if (key == "d")
+            {
+                emit(FmtOp::TIME, val.size(), nextTimeKey());
+                _pool.append(val);
+                _pool.push_back('\0');
+            }
+            else if (key == "e")
+                emit(FmtOp::SUBSEC, 3);
+            else if (key == "u")
+                emit(FmtOp::SUBSEC, 6);
+            else if (key == "N")
+                emit(FmtOp::SUBSEC, 9);
+            else if (key == "D")
+                emit(FmtOp::ISO_LOCAL, 0, nextTimeKey());
+            else if (key == "Z")
+                emit(FmtOp::ISO_UTC, 0, nextTimeKey());
+            else if (key == "t")
+                emit(FmtOp::THREAD);
+            else if (key == "c")
+                emit(FmtOp::LOGGER);
+            else if (key == "f")
+                emit(FmtOp::FILE);
+            else if (key == "s")
+                emit(FmtOp::BASENAME);
+            else if (key == "l")
+                emit(FmtOp::LINE);
+            else if (key == "p")
+                emit(FmtOp::LEVEL);
+            else if (key == "m")
+                emit(FmtOp::MSG);
         }
 
         // 根据不同的格式化字符串创建不同的格式化子项对象
@@ -238,12 +646,24 @@ namespace zx
         {
             if (key == "d")
                 return std::make_shared<TimeFormatItem>(val);
+            if (key == "e")
+                return std::make_shared<SubSecondFormatItem>(3);
+            if (key == "u")
+                return std::make_shared<SubSecondFormatItem>(6);
+            if (key == "N")
+                return std::make_shared<SubSecondFormatItem>(9);
+            if (key == "D")
+                return std::make_shared<IsoTimeFormatItem>(false);
+            if (key == "Z")
+                return std::make_shared<IsoTimeFormatItem>(true);
             if (key == "t")
                 return std::make_shared<ThreadFormatItem>();
             if (key == "c")
                 return std::make_shared<LoggerFormatItem>();
             if (key == "f")
                 return std::make_shared<FileFormatItem>();
+            if (key == "s")
+                return std::make_shared<BasenameFormatItem>();
             if (key == "l")
                 return std::make_shared<LineFormatItem>();
             if (key == "p")
@@ -263,7 +683,10 @@ namespace zx
 
     private:
         std::string _pattern; // 格式化规则字符串
+        std::vector<std::pair<std::string, std::string>> _order; // 解析得到的格式化字符与子规则
         std::vector<FormatItem::ptr> _items;
+        std::vector<FmtInstr> _program; // 编译后的指令数组
+        std::string _pool;              // 指令引用的字符串池
     };
 } // namespace zx
 
@@ -6,6 +6,22 @@
 #ifndef __M_LEVEL_H__
 #define __M_LEVEL_H__
 
+/*
+    编译期最低日志等级, 低于该等级的日志宏在编译期直接去除
+        例如: g++ -DZX_MIN_LEVEL=ZX_LEVEL_INFO ...  --> debug/DEBUG 宏不产生任何代码
+    取值与 LogLevel::value 中的枚举值一一对应
+*/
+#define ZX_LEVEL_DEBUG 1
+#define ZX_LEVEL_INFO 2
+#define ZX_LEVEL_WARN 3
+#define ZX_LEVEL_ERROR 4
+#define ZX_LEVEL_FATAL 5
+#define ZX_LEVEL_OFF 6
+
+#ifndef ZX_MIN_LEVEL
+#define ZX_MIN_LEVEL ZX_LEVEL_DEBUG
+#endif
+
 namespace zx
 {
     // 定义枚举类
@@ -45,5 +61,8 @@ namespace zx
             return "UNKNOW";
         }
     };
+
+    static_assert((int)LogLevel::value::DEBUG == ZX_LEVEL_DEBUG && (int)LogLevel::value::OFF == ZX_LEVEL_OFF,
+                  "ZX_LEVEL_* 必须与 LogLevel::value 的取值保持一致");
 } // namespace zx
 #endif
\ No newline at end of file
@@ -11,6 +11,7 @@
 #endif
 #include "sink.hpp"
 #include "looper.hpp"
+#include "record.hpp"
 #include <unordered_map>
 #include <atomic>
 #include <mutex>
@@ -25,142 +26,215 @@ namespace zx
 
         Logger(const std::string &logger_name, LogLevel::value level,
                Formatter::ptr &formatter, std::vector<LogSink::ptr> &sinks)
-            : _logger_name(logger_name), _limit_level(level), _formatter(formatter),
-              _sinks(sinks.begin(), sinks.end()) {}
+            : _logger_name(logger_name), _limit_level(level), _formatter(formatter->bindLogger(logger_name)),
+              _sinks(sinks.begin(), sinks.end()), _deferred(false) {}
 
         const std::string &name() { return _logger_name; }
 
+        // 当前等级是否需要输出 --> 只有一次 relaxed 的原子读取
+        bool shouldLog(LogLevel::value level) const
+        {
+            return level >= _limit_level.load(std::memory_order_relaxed);
+        }
+
+        // 宏接口的等级判断: 先判断等级, 通过后才调用 f 对参数求值并输出日志
+        // 低于 ZX_MIN_LEVEL 的等级选择空实现, f 不会被实例化调用, 在编译期就被去除
+        template <LogLevel::value L, typename F>
+        typename std::enable_if<((int)L >= ZX_MIN_LEVEL)>::type
+        logIf(std::integral_constant<LogLevel::value, L>, const F &f)
+        {
+            if (shouldLog(L))
+                f(*this);
+        }
+
+        template <LogLevel::value L, typename F>
+        typename std::enable_if<((int)L < ZX_MIN_LEVEL)>::type
+        logIf(std::integral_constant<LogLevel::value, L>, const F &) {}
+
         // 完成构造日志消息对象过程进行格式化, 得到格式化后的日志消息字符串 --> 然后进行日志落地输出
+        /*
+            1. 判断当前日志是否达到了输出等级
+            2. 将格式化字符串与参数写入线程局部缓冲区, 得到日志消息的字符串
+            3. 构造LogMsg对象
+            4. 通过格式化工具对LogMsg进行格式化, 得到格式化后的日志字符串
+            5. 进行日志落地
+        */
+        // 宏接口, 由 bitlog.h 中的宏通过 ZX_SITE 传入调用点描述符, {} 的个数在编译期与参数个数校验
+        template <size_t N, typename... Args>
+        void debug(const LogSiteRef<N> &site, const Args &...args) { logFmt(site, args...); }
+
+        template <size_t N, typename... Args>
+        void info(const LogSiteRef<N> &site, const Args &...args) { logFmt(site, args...); }
+
+        template <size_t N, typename... Args>
+        void warn(const LogSiteRef<N> &site, const Args &...args) { logFmt(site, args...); }
+
+        template <size_t N, typename... Args>
+        void error(const LogSiteRef<N> &site, const Args &...args) { logFmt(site, args...); }
+
+        template <size_t N, typename... Args>
+        void fatal(const LogSiteRef<N> &site, const Args &...args) { logFmt(site, args...); }
+
+        // printf 风格接口, 保持原有调用方式不变
         void debug(const std::string &file, size_t line, const std::string &fmt, ...)
         {
-            /*
-                1. 判断当前日志是否达到了输出等级
-                2. 对fmt格式化字符串和不定参进行字符串组织, 得到日志消息的字符串
-                3. 构造LogMsg对象
-                4. 通过格式化工具对LogMsg进行格式化, 得到格式化后的日志字符串
-                5. 进行日志落地
-            */
-            // 1. 判断当前日志是否达到了输出等级
-            if (LogLevel::value::DEBUG < _limit_level)
-            {
-                return;
-            }
-            // 2. 对fmt格式化字符串和不定参进行字符串组织, 得到日志消息的字符串
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
-            {
-                std::cout << "vasprintf failed!\n";
-                return;
-            }
+            vlogPrintf(LogLevel::value::DEBUG, file.c_str(), line, fmt.c_str(), ap);
             va_end(ap);
-            serialize(LogLevel::value::DEBUG, file, line, res);
-            free(res);
         }
 
         void info(const std::string &file, size_t line, const std::string &fmt, ...)
         {
-            // 1. 判断当前日志是否达到了输出等级
-            if (LogLevel::value::INFO < _limit_level)
-            {
-                return;
-            }
-            // 2. 对fmt格式化字符串和不定参进行字符串组织, 得到日志消息的字符串
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
-            {
-                std::cout << "vasprintf failed!\n";
-                return;
-            }
+            vlogPrintf(LogLevel::value::INFO, file.c_str(), line, fmt.c_str(), ap);
             va_end(ap);
-            serialize(LogLevel::value::INFO, file, line, res);
-            free(res);
         }
 
         void warn(const std::string &file, size_t line, const std::string &fmt, ...)
         {
-            // 1. 判断当前日志是否达到了输出等级
-            if (LogLevel::value::WARN < _limit_level)
-            {
-                return;
-            }
-            // 2. 对fmt格式化字符串和不定参进行字符串组织, 得到日志消息的字符串
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
-            {
-                std::cout << "vasprintf failed!\n";
-                return;
-            }
+            vlogPrintf(LogLevel::value::WARN, file.c_str(), line, fmt.c_str(), ap);
             va_end(ap);
-            serialize(LogLevel::value::WARN, file, line, res);
-            free(res);
         }
 
         void error(const std::string &file, size_t line, const std::string &fmt, ...)
         {
+            va_list ap;
+            va_start(ap, fmt);
+            vlogPrintf(LogLevel::value::ERROR, file.c_str(), line, fmt.c_str(), ap);
+            va_end(ap);
+        }
+
+        void fatal(const std::string &file, size_t line, const std::string &fmt, ...)
+        {
+            va_list ap;
+            va_start(ap, fmt);
+            vlogPrintf(LogLevel::value::FATAL, file.c_str(), line, fmt.c_str(), ap);
+            va_end(ap);
+        }
+
+    protected:
+        template <size_t N, typename... Args>
+        void logFmt(const LogSiteRef<N> &ref, const Args &...args)
+        {
+            static_assert(N == sizeof...(Args), "日志格式化字符串中 {} 的个数与参数个数不一致");
+            const LogSite *site = ref.site();
             // 1. 判断当前日志是否达到了输出等级
-            if (LogLevel::value::ERROR < _limit_level)
+            if (shouldLog(site->_level) == false)
+                return;
+            // 延迟格式化模式: 只记录参数的原始字节, 由异步线程完成格式化
+            if (_deferred)
             {
+                FmtBuffer &rec = threadRecordBuffer();
+                size_t len = encodeRecord(rec, site, captureArg(args)...);
+                log(rec.data(), len, site->_level, recordStamp(rec.data()));
                 return;
             }
+            // 2. 将参数直接写入线程局部缓冲区
+            FmtBuffer &buf = threadPayloadBuffer();
+            buf.clear();
+            formatPayload(buf, site->_fmt, args...);
+            serialize(site, buf.data(), buf.size());
+        }
+
+        // 不含 {} 的格式化字符串按 printf 风格处理
+        template <typename... Args>
+        void logFmt(const LogSiteRef<PRINTF_STYLE> &ref, const Args &...args)
+        {
+            if (shouldLog(ref.site()->_level) == false)
+                return;
+            logPrintf(ref.site(), args...);
+        }
+
+        void logPrintf(const LogSite *site, ...)
+        {
             // 2. 对fmt格式化字符串和不定参进行字符串组织, 得到日志消息的字符串
+            FmtBuffer &buf = threadPayloadBuffer();
+            buf.clear();
             va_list ap;
-            va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
+            va_start(ap, site);
+            bool ret = vformatPayload(buf, site->_fmt, ap);
+            va_end(ap);
+            if (ret == false)
+            {
+                std::cout << "vsnprintf failed!\n";
+                return;
+            }
+            // printf 风格无法保存 va_list, 主体消息在调用线程格式化, 日志格式仍交给异步线程
+            if (_deferred)
             {
-                std::cout << "vasprintf failed!\n";
+                FmtBuffer &rec = threadRecordBuffer();
+                size_t len = encodeFormatted(rec, site, buf.data(), buf.size());
+                log(rec.data(), len, site->_level, recordStamp(rec.data()));
                 return;
             }
+            serialize(site, buf.data(), buf.size());
+        }
+
+        // 运行时的格式化字符串不能放入静态描述符, 按 printf 风格处理
+        template <typename... Args>
+        void logFmt(const LogSiteRef<RUNTIME_FMT> &ref, const Args &...args)
+        {
+            const LogSite *site = ref.site();
+            logRuntime(site->_level, site->_file, site->_line, ref.fmt(), args...);
+        }
+
+        void logRuntime(LogLevel::value level, const char *file, size_t line, const char *fmt, ...)
+        {
+            va_list ap;
+            va_start(ap, fmt);
+            vlogPrintf(level, file, line, fmt, ap);
             va_end(ap);
-            serialize(LogLevel::value::ERROR, file, line, res);
-            free(res);
         }
 
-        void fatal(const std::string &file, size_t line, const std::string &fmt, ...)
+        void vlogPrintf(LogLevel::value level, const char *file, size_t line,
+                        const char *fmt, va_list ap)
         {
             // 1. 判断当前日志是否达到了输出等级
-            if (LogLevel::value::FATAL < _limit_level)
-            {
+            if (shouldLog(level) == false)
                 return;
-            }
+            // 运行时传入的文件名与行号或格式化字符串没有静态描述符, 临时构造一个
+            LogSite site(file, line, level, fmt);
             // 2. 对fmt格式化字符串和不定参进行字符串组织, 得到日志消息的字符串
-            va_list ap;
-            va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
+            FmtBuffer &buf = threadPayloadBuffer();
+            buf.clear();
+            if (vformatPayload(buf, fmt, ap) == false)
             {
-                std::cout << "vasprintf failed!\n";
+                std::cout << "vsnprintf failed!\n";
                 return;
             }
-            va_end(ap);
-            serialize(LogLevel::value::FATAL, file, line, res);
-            free(res);
+            serialize(&site, buf.data(), buf.size());
         }
 
-    protected:
-        void serialize(LogLevel::value level, const std::string &file, size_t line, char *str)
+        void serialize(const LogSite *site, const char *str, size_t len)
         {
             // 3. 构造LogMsg对象
-            LogMsg msg(level, file, line, _logger_name, str);
-            // 4. 通过格式化工具对LogMsg进行格式化, 得到格式化后的日志字符串
-            std::stringstream ss;
-            _formatter->format(ss, msg);
-            // 5. 进行日志落地
-            log(ss.str().c_str(), ss.str().size());
+            LogMsg msg(site, _logger_name.c_str(), str, len);
+            // 异步日志器直接格式化到异步缓冲区中预留的空间
+            if (!_deferred && logInPlace(msg))
+                return;
+            // 4. 通过格式化工具对LogMsg进行格式化, 得到格式化后的日志字符串 --> 写入线程复用的缓冲区
+            FmtBuffer &data = threadLineBuffer();
+            data.clear();
+            _formatter->format(data, msg);
+            // 5. 进行日志落地 --> 延迟格式化模式下只有临时描述符会走到这里, 以完整日志的形式记录
+            if (_deferred)
+            {
+                FmtBuffer &rec = threadRecordBuffer();
+                size_t rec_len = encodeFormatted(rec, nullptr, data.data(), data.size());
+                log(rec.data(), rec_len, site->_level, msg.stampNs());
+                return;
+            }
+            log(data.data(), data.size(), site->_level, msg.stampNs());
         }
 
-        virtual void log(const char *data, size_t len) = 0;
+        // level 为日志等级, 供异步日志器的溢出策略使用; stamp 为日志中打印的时间戳(纳秒), 供按时间戳归并使用
+        virtual void log(const char *data, size_t len, LogLevel::value level, uint64_t stamp) = 0;
+        // 将 msg 直接格式化到落地位置, 不支持时返回 false, 由调用者格式化到线程缓冲区后调用 log
+        virtual bool logInPlace(const LogMsg &) { return false; }
 
     protected:
         std::mutex _mutex;
@@ -168,6 +242,7 @@ namespace zx
         std::atomic<LogLevel::value> _limit_level;
         Formatter::ptr _formatter;
         std::vector<LogSink::ptr> _sinks;
+        bool _deferred; // 延迟格式化模式, 仅异步日志器支持
     };
 
     class SyncLogger : public Logger
@@ -179,7 +254,8 @@ namespace zx
 
     protected:
         // 同步日志器, 是将日志直接通过落地模块句柄进行日志落地
-        void log(const char *data, size_t len)
+        //  每条日志之后调用 idle 写出落地方向暂存的数据 --> 返回之前日志已经写入文件, 进程崩溃也不会丢失
+        void log(const char *data, size_t len, LogLevel::value level, uint64_t)
         {
             std::unique_lock<std::mutex> lock(_mutex);
             if (_sinks.empty())
@@ -187,6 +263,8 @@ namespace zx
             for (auto &sink : _sinks)
             {
                 sink->log(data, len);
+                sink->sync(level);
+                sink->idle();
             }
         }
     };
@@ -196,30 +274,248 @@ namespace zx
     public:
         AsyncLogger(const std::string &logger_name, LogLevel::value level,
                     Formatter::ptr &formatter, std::vector<LogSink::ptr> &sinks,
-                    AsyncType looper_type)
+                    const AsyncOptions &options, bool deferred = false)
             : Logger(logger_name, level, formatter, sinks),
+              _priority_level(options._priority_sync ? options._priority_level : LogLevel::value::OFF),
               _looper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::realLog,
                                                               this, std::placeholders::_1),
-                                                    looper_type)) {}
+                                                    looperOptions(options, deferred),
+                                                    std::bind(&AsyncLogger::idleSinks, this)))
+        {
+            _deferred = deferred;
+        }
 
         // 将数据写入缓冲区
-        void log(const char *data, size_t len)
+        void log(const char *data, size_t len, LogLevel::value level, uint64_t stamp)
         {
-            _looper->push(data, len);
+            // 同步优先通道: 高等级日志在调用线程中直接落地并刷新
+            if (level >= _priority_level)
+                return logNow(data, len, level);
+            _looper->push(data, len, level, stamp);
         }
 
-        // 实际落地函数
+        // 在异步缓冲区中按格式化结果的长度上限预留空间, 格式化器直接写入其中, 省去线程缓冲区到异步缓冲区的拷贝
+        //  双缓冲区模式不预留, 由调用者在锁外格式化到线程缓冲区, push 持锁期间只做拷贝
+        bool logInPlace(const LogMsg &msg) override
+        {
+            LogLevel::value level = msg._site->_level;
+            size_t threshold = _looper->sliceThreshold();
+            if (level >= _priority_level || (threshold == 0 && !_looper->reservable()))
+                return false;
+            uint64_t stamp = msg.stampNs();
+            size_t hint = _formatter->sizeHint(msg);
+            // 大日志直接格式化到切片中, 异步缓冲区只保存切片的描述符
+            if (threshold > 0 && hint >= threshold)
+            {
+                Slice *slice = Slice::create(hint);
+                FmtBuffer out(slice->data(), slice->capacity());
+                try
+                {
+                    _formatter->format(out, msg);
+                }
+                catch (...)
+                {
+                    slice->unref();
+                    throw;
+                }
+                if (out.external())
+                {
+                    slice->resize(out.size());
+                    _looper->pushSlice(slice, level, stamp);
+                }
+                else
+                {
+                    slice->unref();
+                    _looper->push(out.data(), out.size(), level, stamp);
+                }
+                return true;
+            }
+            AsyncSlot slot;
+            if (!_looper->reserve(slot, hint, level, stamp))
+                return false;
+            SlotGuard guard(_looper.get(), slot);
+            FmtBuffer out(slot._data, slot._cap);
+            _formatter->format(out, msg);
+            guard.dismiss();
+            if (out.external())
+            {
+                _looper->commit(slot, out.size());
+                return true;
+            }
+            // 长度超过了预留的空间, 放弃预留, 按原来的方式写入
+            _looper->cancel(slot);
+            _looper->push(out.data(), out.size(), level, stamp);
+            return true;
+        }
+
+        // 实际落地函数, 没有新日志时工作器也会交来空的批次, 用于按时输出丢弃统计
         void realLog(Buffer &buf)
         {
             if (_sinks.empty())
                 return;
+            // 与同步优先通道互斥地使用落地方向与解码缓冲区
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_deferred)
+                decodeLog(buf.begin(), buf.readAbleSize());
+            else
+                writeBatch(buf);
+            for (auto &sink : _sinks)
+                sink->sync(buf.maxLevel());
+        }
+
+        // 工作器空闲时调用: 落地方向写出暂存的数据并处理到期的定期落盘, 返回最早的下次调用时间
+        std::chrono::nanoseconds idleSinks()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::chrono::nanoseconds next(0);
+            for (auto &sink : _sinks)
+            {
+                std::chrono::nanoseconds n = sink->idle();
+                if (n.count() > 0 && (next.count() == 0 || n < next))
+                    next = n;
+            }
+            return next;
+        }
+
+        // 因缓冲区满被溢出策略丢弃的日志条数
+        uint64_t droppedCount() { return _looper->droppedTotal(); }
+
+    private:
+        // 格式化抛出异常时放弃预留的空间, 否则工作线程会一直停在这条未发布的记录上
+        class SlotGuard
+        {
+        public:
+            SlotGuard(AsyncLooper *looper, AsyncSlot &slot) : _looper(looper), _slot(slot), _armed(true) {}
+            ~SlotGuard()
+            {
+                if (_armed)
+                    _looper->cancel(_slot);
+            }
+            void dismiss() { _armed = false; }
+
+        private:
+            AsyncLooper *_looper;
+            AsyncSlot &_slot;
+            bool _armed;
+        };
+
+        void writeBatch(Buffer &buf)
+        {
+            // 有日志因缓冲区满被丢弃时, 在本批日志之前输出一条统计
+            _decode_out.clear();
+            if (appendDropped(_decode_out))
+            {
+                for (auto &sink : _sinks)
+                    sink->log(_decode_out.data(), _decode_out.size());
+            }
+            if (buf.empty())
+                return;
+            if (!buf.slices().empty())
+                return logSlices(buf);
             for (auto &sink : _sinks)
             {
                 sink->log(buf.begin(), buf.readAbleSize());
             }
         }
 
+        // 延迟格式化模式下缓冲区中是连续的二进制记录, 不使用切片
+        static AsyncOptions looperOptions(const AsyncOptions &options, bool deferred)
+        {
+            AsyncOptions opts(options);
+            if (deferred)
+                opts._slice_threshold = 0;
+            return opts;
+        }
+
+        // 缓冲区中的日志与切片按写入顺序交错组成一组 iovec, 一次性交给落地方向
+        void logSlices(Buffer &buf)
+        {
+            _iov.clear();
+            size_t prev = 0;
+            for (auto &mark : buf.slices())
+            {
+                if (mark._off > prev)
+                    _iov.push_back({const_cast<char *>(buf.begin()) + prev, mark._off - prev});
+                _iov.push_back({mark._slice->data(), mark._slice->size()});
+                prev = mark._off;
+            }
+            if (buf.readAbleSize() > prev)
+                _iov.push_back({const_cast<char *>(buf.begin()) + prev, buf.readAbleSize() - prev});
+            for (auto &sink : _sinks)
+                sink->logv(_iov.data(), (int)_iov.size());
+        }
+
+        void logNow(const char *data, size_t len, LogLevel::value level)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_deferred)
+                decodeLog(data, len);
+            else
+            {
+                for (auto &sink : _sinks)
+                    sink->log(data, len);
+            }
+            for (auto &sink : _sinks)
+            {
+                sink->flush();
+                sink->sync(level);
+            }
+        }
+
+        // 追加一条 "N messages dropped" 的统计日志, 没有丢弃时返回 false
+        bool appendDropped(FmtBuffer &out)
+        {
+            uint64_t dropped = _looper->takeDropped();
+            if (dropped == 0)
+                return false;
+            static constexpr LogSite site(__FILE__, __LINE__, LogLevel::value::WARN,
+                                          "{} messages dropped by async overflow policy");
+            _decode_payload.clear();
+            formatPayload(_decode_payload, site._fmt, dropped);
+            LogMsg msg(&site, _logger_name.c_str(), _decode_payload.data(), _decode_payload.size());
+            _formatter->format(out, msg);
+            return true;
+        }
+
+        // 对 [data, data + len) 中的二进制记录逐条解码并格式化, 然后统一落地
+        void decodeLog(const char *data, size_t len)
+        {
+            _decode_out.clear();
+            appendDropped(_decode_out);
+            const char *end = data + len;
+            while (data < end)
+            {
+                RecordHeader hdr;
+                memcpy(&hdr, data, sizeof(hdr));
+                _decode_payload.clear();
+                hdr._decode(_decode_payload, hdr._site, data + sizeof(hdr));
+                if (hdr._site == nullptr)
+                {
+                    // 已经格式化完成的整条日志
+                    _decode_out.append(_decode_payload.data(), _decode_payload.size());
+                }
+                else
+                {
+                    LogMsg msg(hdr._site, _logger_name.c_str(), _decode_payload.data(),
+                               _decode_payload.size(), hdr._ctime, hdr._tid);
+                    _formatter->format(_decode_out, msg);
+                }
+                data += hdr._len;
+            }
+            if (_decode_out.size() == 0)
+                return;
+            for (auto &sink : _sinks)
+            {
+                sink->log(_decode_out.data(), _decode_out.size());
+            }
+        }
+
     private:
+        LogLevel::value _priority_level; // 同步优先通道的等级, OFF 表示不启用
+        // 以下成员只在持有 _mutex 时使用
+        FmtBuffer _decode_payload;
+        FmtBuffer _decode_out;
+        std::vector<struct iovec> _iov;
         AsyncLooper::ptr _looper;
     };
 
@@ -244,13 +540,57 @@ namespace zx
     {
     public:
         LoggerBuilder()
-            : _logger_type(LoggerType::LOGGER_ASYNC),
-              _limit_level(LogLevel::value::DEBUG),
-              _looper_type(AsyncType::ASYNC_SAFE) {}
+            : _deferred_format(false),
+              _logger_type(LoggerType::LOGGER_ASYNC),
+              _limit_level(LogLevel::value::DEBUG) {}
 
         void buildLoggerType(LoggerType type) { _logger_type = type; }
         void buildLoggerName(const std::string &name) { _logger_name = name; }
-        void buildEnableUnSafeAsync() { _looper_type = AsyncType::ASYNC_UNSAFE; }
+        void buildEnableUnSafeAsync() { _async_options._type = AsyncType::ASYNC_UNSAFE; }
+        // 无锁异步模式: 生产者通过原子操作预留环形缓冲区空间, 不再竞争同一把互斥锁
+        void buildEnableLockFreeAsync() { _async_options._type = AsyncType::ASYNC_LOCKFREE; }
+        // 线程队列异步模式: 每个生产者线程独占一个队列, 适合线程绑定CPU核心的服务
+        void buildEnablePerThreadAsync() { _async_options._type = AsyncType::ASYNC_PERTHREAD; }
+        // 按打印的时间戳归并各线程的日志, 同一个日志器的输出按时间戳有序; window 为等待迟到记录的时间窗口
+        //  只在日志器内部归并, 不同日志器之间(包括写同一个文件时)不保证顺序
+        void buildEnableOrderedAsync(std::chrono::microseconds window = std::chrono::microseconds(1000))
+        {
+            _async_options._type = AsyncType::ASYNC_PERTHREAD;
+            _async_options._reorder_window = window;
+        }
+        // 异步工作线程没有数据时先自旋等待的时间, 之后才睡眠; 生产者只在其睡眠时才需要唤醒它
+        void buildAsyncSpinTime(std::chrono::microseconds spin) { _async_options._spin_time = spin; }
+        // 批量落地策略: 异步线程攒够 min_batch 字节, 或者攒批超过 latency 才落地一次, 每次落地不超过 max_batch 字节
+        void buildFlushInterval(std::chrono::microseconds latency) { _async_options._flush_interval = latency; }
+        void buildMinBatchBytes(size_t min_batch) { _async_options._min_batch = min_batch; }
+        void buildMaxBatchBytes(size_t max_batch) { _async_options._max_batch = max_batch; }
+        // 缓冲区满时的处理策略, timeout 用于 BLOCK_TIMEOUT, keep_level 用于 DROP_BELOW_LEVEL
+        //  DROP_OLDEST 只支持 ASYNC_SAFE/ASYNC_UNSAFE, 其他模式下构造日志器时抛出 std::invalid_argument
+        void buildOverflowPolicy(OverflowPolicy policy) { _async_options._overflow = policy; }
+        void buildOverflowTimeout(std::chrono::milliseconds timeout) { _async_options._overflow_timeout = timeout; }
+        void buildOverflowKeepLevel(LogLevel::value level) { _async_options._keep_level = level; }
+        // 有日志被丢弃时输出 "N messages dropped" 统计的最小间隔, 没有新日志时也会按时输出
+        void buildDropReportInterval(std::chrono::milliseconds interval) { _async_options._drop_report = interval; }
+        // 优先通道: 不低于 level 的日志绕过普通日志的积压优先落地; sync 为 true 时在调用线程中直接落地并刷新
+        void buildPriorityLane(LogLevel::value level, bool sync = false)
+        {
+            _async_options._priority_level = level;
+            _async_options._priority_sync = sync;
+        }
+        // 异步缓冲区扩容后空闲超过 idle 则归还多出的内存, 为 0 表示不缩容
+        void buildShrinkIdle(std::chrono::milliseconds idle) { _async_options._shrink_idle = idle; }
+        // 异步缓冲区的内存分配方式: 大页/构建时预先缺页/mlock 锁定; 使用线程池时同样只作用于本日志器的缓冲区
+        void buildBufferMemory(bool huge_pages, bool prefault = true, bool lock = false)
+        {
+            _async_options._memory = MemPolicy(huge_pages, prefault, lock);
+        }
+        // 不低于 bytes 的日志存放在引用计数的切片中, 不拷贝进异步缓冲区, 落地时以聚集写输出
+        //  默认为 0, 不使用切片; 大日志较多时可以设为 16KB 左右
+        void buildSliceThreshold(size_t bytes) { _async_options._slice_threshold = bytes; }
+        // 使用共享的后台线程池处理异步日志, 而不是每个日志器独占一个工作线程; 同一个日志器的输出顺序不变
+        void buildWorkerPool(const AsyncWorkerPool::ptr &pool = AsyncWorkerPool::shared()) { _async_options._pool = pool; }
+        // 异步日志器的延迟格式化模式: 生产者只写入二进制记录, 格式化放到异步线程中完成
+        void buildEnableDeferredFormat() { _deferred_format = true; }
         void buildLoggerLevel(LogLevel::value level) { _limit_level = level; }
         void buildFormatter(const std::string &pattern) { _formatter = std::make_shared<Formatter>(pattern); }
         template <typename SinkType, typename... Args>
@@ -262,7 +602,8 @@ namespace zx
         virtual Logger::ptr build() = 0;
 
     protected:
-        AsyncType _looper_type;
+        AsyncOptions _async_options;
+        bool _deferred_format;
         LoggerType _logger_type;
         std::string _logger_name;
         LogLevel::value _limit_level;
@@ -285,7 +626,7 @@ namespace zx
 
             if (_logger_type == LoggerType::LOGGER_ASYNC)
                 return std::make_shared<AsyncLogger>(_logger_name, _limit_level,
-                                                     _formatter, _sinks, _looper_type);
+                                                     _formatter, _sinks, _async_options, _deferred_format);
 
             return std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter, _sinks);
         }
@@ -336,6 +677,8 @@ namespace zx
         {
             std::unique_ptr<zx::LoggerBuilder> builder(new zx::LocalLoggerBuilder());
             builder->buildLoggerName("root");
+            // 默认日志器不独占工作线程, 与其他挂在默认线程池上的日志器共用
+            builder->buildWorkerPool();
             _root_logger = builder->build();
             _loggers.insert(std::make_pair("root", _root_logger));
         }
@@ -362,7 +705,7 @@ namespace zx
             Logger::ptr logger;
             if (_logger_type == LoggerType::LOGGER_ASYNC)
                 logger = std::make_shared<AsyncLogger>(_logger_name, _limit_level,
-                                                       _formatter, _sinks, _looper_type);
+                                                       _formatter, _sinks, _async_options, _deferred_format);
             else
                 logger = std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter, _sinks);
 
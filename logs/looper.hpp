@@ -4,93 +4,1360 @@
 #define __M_LOOPER_H__
 
 #include "buffer.hpp"
+#include "util.hpp"
+#include "parker.hpp"
+#include "level.hpp"
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <stdexcept>
 
 namespace zx
 {
     using Functor = std::function<void(Buffer &)>;
+    // 工作器空闲时的回调, 返回还需要多久再调用一次, 0 表示不需要
+    using IdleFunctor = std::function<std::chrono::nanoseconds()>;
     enum class AsyncType
     {
         ASYNC_SAFE,  // 安全状态, 满了就阻塞, 避免资源耗尽
-        ASYNC_UNSAFE // 非安全转态, 无限扩容, 用于性能测试
+        ASYNC_UNSAFE, // 非安全转态, 无限扩容, 用于性能测试
+        ASYNC_LOCKFREE, // 无锁环形缓冲区, 生产者之间不竞争互斥锁, 满了就等待
+        ASYNC_PERTHREAD // 每个生产者线程独占一个单生产者队列, 生产者之间没有任何共享的写位置
+    };
+
+    // 缓冲区满时的处理策略, 对 ASYNC_UNSAFE 之外的模式生效; ASYNC_UNSAFE 在内存预算用完或攒够 _max_batch 时生效
+    enum class OverflowPolicy
+    {
+        BLOCK,            // 阻塞等待空间
+        BLOCK_TIMEOUT,    // 最多阻塞等待 _overflow_timeout, 超时则丢弃
+        DROP_NEWEST,      // 直接丢弃新的日志
+        DROP_OLDEST,      // 丢弃生产缓冲区中尚未处理的一批旧日志; 只支持双缓冲区模式, 环形缓冲区/线程队列模式下
+                          //  生产者不能移动读位置, 构造工作器时抛出 std::invalid_argument
+        DROP_BELOW_LEVEL  // 低于 _keep_level 的日志直接丢弃, 其余阻塞等待
+    };
+
+    class AsyncWorkerPool;
+
+    // 异步工作器的配置
+    struct AsyncOptions
+    {
+        AsyncOptions(AsyncType type = AsyncType::ASYNC_SAFE)
+            : _type(type), _reorder_window(0), _spin_time(20),
+              _flush_interval(0), _min_batch(0), _max_batch(0),
+              _overflow(OverflowPolicy::BLOCK), _overflow_timeout(0),
+              _keep_level(LogLevel::value::WARN), _drop_report(1000),
+              _priority_level(LogLevel::value::OFF), _priority_sync(false),
+              _shrink_idle(5000), _slice_threshold(0) {}
+
+        AsyncType _type;
+        // 线程队列模式下, 按日志打印的时间戳归并各线程的记录时等待迟到记录的窗口, 为 0 表示不归并
+        //  归并只在同一个工作器(日志器)内进行
+        std::chrono::microseconds _reorder_window;
+        // 工作线程没有数据时先自旋等待的时间, 之后才真正睡眠, 为 0 表示直接睡眠
+        std::chrono::microseconds _spin_time;
+        // 批量落地策略: 待处理数据不足 _min_batch 字节时最多等待 _flush_interval 再交给回调
+        //  _flush_interval 为 0 表示有数据就交给回调; 每次交给回调的数据不超过 _max_batch 字节, 为 0 表示不限制
+        std::chrono::microseconds _flush_interval;
+        size_t _min_batch;
+        size_t _max_batch;
+        // 缓冲区满时的处理策略
+        OverflowPolicy _overflow;
+        std::chrono::milliseconds _overflow_timeout;
+        LogLevel::value _keep_level;
+        // 有日志被丢弃时, 工作器至多每隔 _drop_report 交给回调一次统计, 没有新的日志也会按时交出
+        std::chrono::milliseconds _drop_report;
+        // 优先通道: 不低于 _priority_level 的日志走单独的队列, 工作线程优先处理, 不受批量策略影响
+        //  队列的容量固定为 DEFAULT_URGENT_SIZE, 计入内存预算, 满了按溢出策略处理
+        //  _priority_sync 为 true 时由日志器在调用线程中直接落地并刷新, 不经过工作线程
+        LogLevel::value _priority_level;
+        bool _priority_sync;
+        // 共享后台线程池, 为空表示工作器独占一个工作线程
+        std::shared_ptr<AsyncWorkerPool> _pool;
+        // 缓冲区扩容后空闲超过该时间则缩回初始容量, 为 0 表示不缩容
+        std::chrono::milliseconds _shrink_idle;
+        // 异步缓冲区的内存分配方式
+        MemPolicy _memory;
+        // 不低于该长度的日志存放在独立的切片中, 缓冲区中只保存描述符; 默认为 0, 不使用切片
+        //  每条大日志单独分配一次内存, 只在大日志较多时划算, 需要通过 buildSliceThreshold 显式开启
+        size_t _slice_threshold;
+    };
+
+    // 生产者在环形缓冲区/线程队列中预留的一段空间, 由 AsyncLooper::reserve 填写, 交给 commit/cancel
+    struct AsyncSlot
+    {
+        char *_data; // 可以直接写入的地址
+        size_t _cap; // 可以写入的字节数
+        // 以下由工作器使用
+        uint64_t _pos;
+        uint64_t _stamp;
+        SpscRing *_queue;
+        LogLevel::value _level;
     };
 
     class AsyncLooper
     {
     public:
         using ptr = std::shared_ptr<AsyncLooper>;
-        AsyncLooper(const Functor &callback, AsyncType looper_type = AsyncType::ASYNC_SAFE)
-            : _stop(false),
-              _looper_type(looper_type),
-              _thread(std::thread(&AsyncLooper::threadEntry, this)),
-              _callBack(callback) {}
+        AsyncLooper(const Functor &callback, const AsyncOptions &options = AsyncOptions(),
+                    const IdleFunctor &idle = IdleFunctor())
+            : _callBack(callback),
+              _idle(idle),
+              _looper_type(options._type),
+              _stop(false),
+              // 只有双缓冲区模式使用生产缓冲区; 消费缓冲区属于工作器自己, 使用线程池时由池线程借用
+              _pro_buf(options._type == AsyncType::ASYNC_SAFE || options._type == AsyncType::ASYNC_UNSAFE ? DEFAULT_BUFFER_SIZE : 0,
+                       options._memory),
+              _con_buf(DEFAULT_BUFFER_SIZE, options._memory),
+              _pro_size(0),
+              _pro_count(0),
+              _pro_waiting(0),
+              _overflow(checkOverflow(options)),
+              _overflow_timeout(options._overflow_timeout),
+              _keep_level(options._keep_level),
+              _dropped(0),
+              _dropped_total(0),
+              _report_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(options._drop_report).count()),
+              _reported_at(0),
+              _report_armed(false),
+              _priority_level(options._priority_level),
+              _urgent_buf(DEFAULT_URGENT_SIZE, options._memory),
+              _urgent_con(DEFAULT_URGENT_SIZE, options._memory),
+              _urgent_size(0),
+              _urgent_count(0),
+              _spin_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(options._spin_time).count()),
+              _flush_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(options._flush_interval).count()),
+              _shrink_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(options._shrink_idle).count()),
+              _min_batch(minBatch(options)),
+              _max_batch(options._max_batch > 0 ? options._max_batch : SIZE_MAX),
+              _batch_start(0),
+              _ring(options._type == AsyncType::ASYNC_LOCKFREE ? DEFAULT_RING_SIZE : 0, options._memory),
+              _serial(nextSerial()),
+              _queue_version(0),
+              _reorder_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(options._reorder_window).count()),
+              _memory(options._memory),
+              _slice_threshold(options._slice_threshold),
+              _slice_limit(queueCapacity(options)), _slice_pending(0),
+              _drain_version(0),
+              _idle_need(1),
+              _idle_wait(0),
+              _idle_due(false),
+              _idle_at(0),
+              _pool(options._pool),
+              _sched(POOL_IDLE),
+              _timer_at(0),
+              _finished(false),
+              _thread(options._pool ? std::thread() : std::thread(&AsyncLooper::threadEntry, this)) {}
 
         ~AsyncLooper() { stop(); }
 
-        void stop()
+        void stop();
+
+        // level 为日志等级, 供 DROP_BELOW_LEVEL 策略使用; stamp 为日志中打印的时间戳(纳秒), 为 0 表示取当前时间
+        void push(const char *data, size_t len, LogLevel::value level = LogLevel::value::FATAL, uint64_t stamp = 0)
         {
-            _stop = true;
-            _cond_con.notify_all(); // 唤醒所有工作线程
-            _thread.join();         // 等待工作线程退出
+            if (level >= _priority_level)
+                return pushUrgent(data, len, level);
+            // 大日志拷贝到独立的切片中, 缓冲区中只保存描述符
+            if (_slice_threshold > 0 && len >= _slice_threshold)
+            {
+                Slice *slice = Slice::create(len);
+                memcpy(slice->data(), data, len);
+                slice->resize(len);
+                return pushSlice(slice, level, stamp);
+            }
+            if (_looper_type == AsyncType::ASYNC_LOCKFREE)
+                return pushLockFree(data, len, level);
+            if (_looper_type == AsyncType::ASYNC_PERTHREAD)
+                return pushPerThread(data, len, level, stamp);
+            size_t pending;
+            {
+                // 1. 无线扩容 --> 非安全;  2. 固定大小 --> 生产缓冲区满了按溢出策略处理
+                std::unique_lock<std::mutex> lock(_mutex);
+                // 缓冲区剩余空间大于数据长度, 添加数据
+                if (!proFits(len) && !proWait(lock, len, level))
+                {
+                    lock.unlock();
+                    drop(1);
+                    return;
+                }
+                // 添加数据
+                pending = _pro_buf.pendingSize();
+                _pro_buf.push(data, len);
+                _pro_buf.raiseLevel(level);
+                ++_pro_count;
+                _pro_size.store(pending + len, std::memory_order_relaxed);
+            }
+            published(pending, len);
         }
 
-        void push(const char *data, size_t len)
+        // 写入一条存放在切片中的日志, 接管调用者持有的引用
+        //  缓冲区中只保存描述符, 未落地的切片总量以缓冲区容量为上限, 超过时按溢出策略处理
+        void pushSlice(Slice *slice, LogLevel::value level = LogLevel::value::FATAL, uint64_t stamp = 0)
         {
-            // 1. 无线扩容 --> 非安全;  2. 固定大小 --> 生产缓冲区满了就阻塞
-            std::unique_lock<std::mutex> lock(_mutex);
-            // 条件变量为空, 缓冲区剩余空间大于数据长度, 添加数据
-            if (_looper_type == AsyncType::ASYNC_SAFE)
-                _cond_pro.wait(lock, [&]()
-                               { return _pro_buf.writeAbleSize() >= len; });
-            // 添加数据
-            _pro_buf.push(data, len);
-            // 唤醒消费者缓冲区
-            _cond_con.notify_one();
+            size_t len = slice->size();
+            if (level >= _priority_level)
+            {
+                pushUrgent(slice->data(), len, level);
+                return slice->unref();
+            }
+            if (!slicesFit(len) && !sliceWait(len, level))
+            {
+                slice->unref();
+                return drop(1);
+            }
+            _slice_pending.fetch_add(len, std::memory_order_relaxed);
+            auto notify = [this, len](size_t pending)
+            { published(pending, len); };
+            const char *desc = reinterpret_cast<const char *>(&slice);
+            if (_looper_type == AsyncType::ASYNC_LOCKFREE)
+            {
+                if (!_ring.hasSpace(sizeof(slice)) && !queueWait(_ring, sizeof(slice), level))
+                    return dropSlice(slice, len);
+                if (!_ring.push(desc, sizeof(slice), notify, RingBuffer::levelFlags(level) | RingBuffer::SLICE_FLAG))
+                    dropSlice(slice, len);
+                return;
+            }
+            if (_looper_type == AsyncType::ASYNC_PERTHREAD)
+            {
+                stamp = mergeStamp(stamp);
+                SpscRing *q = localQueue();
+                if (q == nullptr)
+                    return dropSlice(slice, len);
+                q->hold(stamp);
+                if (!q->hasSpace(sizeof(slice)) && !queueWait(*q, sizeof(slice), level))
+                {
+                    q->hold(0);
+                    return dropSlice(slice, len);
+                }
+                if (!q->push(desc, sizeof(slice), stamp, notify, SpscRing::levelFlags(level) | SpscRing::SLICE_FLAG))
+                {
+                    q->hold(0);
+                    dropSlice(slice, len);
+                }
+                return;
+            }
+            size_t pending;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                pending = _pro_buf.pendingSize();
+                _pro_buf.pushSlice(slice);
+                _pro_buf.raiseLevel(level);
+                ++_pro_count;
+                _pro_size.store(pending + len, std::memory_order_relaxed);
+            }
+            notify(pending);
+        }
+
+        // 不低于该长度的日志存放在切片中, 0 表示不使用切片
+        size_t sliceThreshold() const { return _slice_threshold; }
+
+        // 是否支持 reserve: 只有环形缓冲区/线程队列模式支持
+        //  双缓冲区模式的生产者之间共用互斥锁, 在锁外格式化到线程缓冲区, 持锁期间只做拷贝
+        bool reservable() const
+        {
+            return _looper_type == AsyncType::ASYNC_LOCKFREE || _looper_type == AsyncType::ASYNC_PERTHREAD;
+        }
+
+        /*
+            在环形缓冲区/线程队列中预留至少 len_hint 字节, 生产者直接在 slot._data 中写入日志, 省去一次拷贝
+                1. 之后必须调用 commit 确认实际写入的长度(不超过 slot._cap), 或者调用 cancel 放弃
+                2. 返回 false 表示不能预留(双缓冲区模式/优先通道/空间不足/超过缓冲区容量), 调用者改用 push, 由 push 按溢出策略等待
+        */
+        bool reserve(AsyncSlot &slot, size_t len_hint, LogLevel::value level = LogLevel::value::FATAL, uint64_t stamp = 0)
+        {
+            if (!reservable() || level >= _priority_level)
+                return false;
+            slot._level = level;
+            if (_looper_type == AsyncType::ASYNC_LOCKFREE)
+            {
+                if (!_ring.hasSpace(len_hint))
+                    return false;
+                slot._data = _ring.reserve(len_hint, slot._pos, [this](size_t pending)
+                                           { published(pending, 0); });
+                slot._cap = len_hint;
+                return slot._data != nullptr;
+            }
+            slot._stamp = mergeStamp(stamp);
+            slot._queue = localQueue();
+            if (slot._queue == nullptr || !slot._queue->hasSpace(len_hint))
+                return false;
+            slot._queue->hold(slot._stamp);
+            slot._data = slot._queue->reserve(len_hint, slot._pos);
+            slot._cap = len_hint;
+            if (slot._data == nullptr)
+                slot._queue->hold(0);
+            return slot._data != nullptr;
         }
 
+        void commit(AsyncSlot &slot, size_t len)
+        {
+            auto notify = [this, len](size_t pending)
+            { published(pending, len); };
+            if (_looper_type == AsyncType::ASYNC_LOCKFREE)
+                return _ring.commit(slot._pos, slot._cap, len, notify, RingBuffer::levelFlags(slot._level));
+            slot._queue->commit(slot._pos, len, slot._stamp, notify, SpscRing::levelFlags(slot._level));
+        }
+
+        void cancel(AsyncSlot &slot)
+        {
+            if (_looper_type == AsyncType::ASYNC_LOCKFREE)
+                return _ring.cancel(slot._pos, slot._cap, [this](size_t pending)
+                                    { published(pending, 0); });
+            slot._queue->hold(0);
+        }
+
+        // 取出上次统计之后被丢弃的日志条数; 距离上次统计不足 _drop_report 时返回 0, 留到之后一起统计
+        //  调用者需要保证同一时刻只有一个线程调用
+        uint64_t takeDropped()
+        {
+            if (_dropped.load(std::memory_order_relaxed) == 0)
+                return 0;
+            uint64_t now = util::Date::monoNs();
+            uint64_t at = _reported_at.load(std::memory_order_relaxed);
+            if (at != 0 && now - at < _report_ns && !_stop)
+                return 0;
+            _reported_at.store(now, std::memory_order_relaxed);
+            return _dropped.exchange(0, std::memory_order_relaxed);
+        }
+        // 累计被丢弃的日志条数
+        uint64_t droppedTotal() { return _dropped_total.load(std::memory_order_relaxed); }
+
     private:
-        // 线程入口函数
-        void threadEntry()
+        friend class AsyncWorkerPool;
+
+        // 优先通道: 高等级日志很少, 使用单独的小缓冲区与互斥锁, 不与普通日志竞争
+        //  缓冲区不扩容, 放不下时与生产缓冲区一样按溢出策略处理 --> 错误日志暴增时不会无限占用内存
+        void pushUrgent(const char *data, size_t len, LogLevel::value level)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_urgent_mutex);
+                if (!urgentFits(len) && !urgentWait(lock, len, level))
+                {
+                    lock.unlock();
+                    drop(1);
+                    return;
+                }
+                _urgent_buf.push(data, len);
+                _urgent_buf.raiseLevel(level);
+                ++_urgent_count;
+                _urgent_size.store(_urgent_buf.readAbleSize(), std::memory_order_release);
+            }
+            wake();
+        }
+
+        // 优先通道的缓冲区能否放下 len 字节; 为空时总能放下, 超过容量的单条日志由缓冲区扩容容纳
+        bool urgentFits(size_t len)
+        {
+            return _urgent_buf.empty() || _urgent_buf.writeAbleSize() >= len;
+        }
+
+        bool urgentWait(std::unique_lock<std::mutex> &lock, size_t len, LogLevel::value level)
+        {
+            return lockedWait(lock, _urgent_cond, [&]()
+                              { return urgentFits(len); }, level, [&]()
+                              {
+                drop(_urgent_count);
+                _urgent_buf.reset();
+                _urgent_count = 0;
+                _urgent_size.store(0, std::memory_order_relaxed); });
+        }
+
+        // 工作线程在处理普通日志之前先处理优先通道中的日志
+        void drainUrgent()
+        {
+            if (_urgent_size.load(std::memory_order_acquire) == 0)
+                return;
+            {
+                std::unique_lock<std::mutex> lock(_urgent_mutex);
+                _urgent_con.swap(_urgent_buf);
+                _urgent_count = 0;
+                _urgent_size.store(0, std::memory_order_relaxed);
+            }
+            _urgent_cond.notify_all();
+            _callBack(_urgent_con);
+            _urgent_con.reset();
+        }
+
+        // 生产者发布数据后调用, pending 为这条数据之前待处理的字节数
+        //  只有待处理数据从无到有(工作线程要开始计时), 或者攒够一批时才尝试唤醒工作线程
+        void published(size_t pending, size_t len)
+        {
+            if (pending == 0 || pending + len >= _min_batch)
+                wake();
+        }
+
+        // 安全模式下生产缓冲区能否放下 len 字节, 同时保证每批数据不超过 _max_batch
+        //  缓冲区为空时总能放下 --> 超过缓冲区大小的单条日志由缓冲区扩容容纳, 而不是永远等待
+        //  非安全模式下不超过 _max_batch 且内存预算允许就扩容
+        bool proFits(size_t len)
+        {
+            if (_pro_buf.empty())
+                return true;
+            if (_pro_buf.readAbleSize() + len > _max_batch)
+                return false;
+            if (_looper_type == AsyncType::ASYNC_UNSAFE)
+                return _pro_buf.tryReserve(len);
+            return _pro_buf.writeAbleSize() >= len;
+        }
+
+        // 生产缓冲区放不下时按溢出策略处理, 返回 false 表示丢弃这条日志
+        bool proWait(std::unique_lock<std::mutex> &lock, size_t len, LogLevel::value level)
+        {
+            return lockedWait(lock, _cond_pro, [&]()
+                              { return proFits(len); }, level, [&]()
+                              {
+                drop(_pro_count);
+                resetOut(_pro_buf);
+                _pro_count = 0;
+                _pro_size.store(0, std::memory_order_relaxed); });
+        }
+
+        // 持有 lock 时按溢出策略等待 fits 成立, 工作线程取走数据后通过 cond 唤醒; 返回 false 表示丢弃这条日志
+        //  drop_oldest 丢弃还没有被工作线程取走的一批日志
+        template <typename Fits, typename DropOldest>
+        bool lockedWait(std::unique_lock<std::mutex> &lock, std::condition_variable &cond,
+                        Fits fits, LogLevel::value level, DropOldest drop_oldest)
+        {
+            switch (_overflow)
+            {
+            case OverflowPolicy::DROP_NEWEST:
+                return false;
+            case OverflowPolicy::DROP_OLDEST:
+                drop_oldest();
+                return true;
+            case OverflowPolicy::DROP_BELOW_LEVEL:
+                if (level < _keep_level)
+                    return false;
+                break;
+            case OverflowPolicy::BLOCK_TIMEOUT:
+            {
+                beginWait();
+                bool ok = cond.wait_for(lock, _overflow_timeout, fits);
+                endWait();
+                return ok;
+            }
+            default:
+                break;
+            }
+            beginWait();
+            cond.wait(lock, fits);
+            endWait();
+            return true;
+        }
+
+        // 生产者开始等待空间: 计数并唤醒工作器, 工作器看到有生产者在等待时不再攒批, 立即交出已有的数据
+        void beginWait()
+        {
+            _pro_waiting.fetch_add(1);
+            wake();
+        }
+
+        void endWait() { _pro_waiting.fetch_sub(1, std::memory_order_relaxed); }
+
+        // 环形缓冲区/线程队列放不下时按溢出策略处理, 返回 false 表示丢弃这条日志
+        template <typename Queue>
+        bool queueWait(Queue &q, size_t len, LogLevel::value level)
+        {
+            // 超过队列容量的记录永远放不下, 交给 push 计入丢弃
+            if (!q.canHold(len))
+                return true;
+            // 与工作线程读取 SpscRing::held 之前的屏障配对
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return overflowWait([&]()
+                                { return q.hasSpace(len); }, level);
+        }
+
+        // 未落地的切片超过上限时按溢出策略处理; 与队列空间共用 _space, 工作线程释放切片时(resetOut)唤醒, 等待期间睡眠
+        bool sliceWait(size_t len, LogLevel::value level)
+        {
+            return overflowWait([&]()
+                                { return slicesFit(len); }, level);
+        }
+
+        template <typename Fits>
+        bool overflowWait(Fits fits, LogLevel::value level)
+        {
+            switch (_overflow)
+            {
+            case OverflowPolicy::DROP_NEWEST:
+            case OverflowPolicy::DROP_OLDEST:
+                return false;
+            case OverflowPolicy::DROP_BELOW_LEVEL:
+                if (level < _keep_level)
+                    return false;
+                break;
+            case OverflowPolicy::BLOCK_TIMEOUT:
+            {
+                uint64_t deadline = util::Date::monoNs() +
+                                    std::chrono::duration_cast<std::chrono::nanoseconds>(_overflow_timeout).count();
+                beginWait();
+                bool ok = _space.waitUntil(fits, deadline);
+                endWait();
+                return ok;
+            }
+            default:
+                break;
+            }
+            beginWait();
+            _space.waitUntil(fits, 0);
+            endWait();
+            return true;
+        }
+
+        // 未落地的切片总量不超过上限, 非安全模式不限制; 没有未落地的切片时总能放下
+        bool slicesFit(size_t len)
+        {
+            if (_looper_type == AsyncType::ASYNC_UNSAFE)
+                return true;
+            size_t pending = _slice_pending.load(std::memory_order_relaxed);
+            return pending == 0 || pending + len <= _slice_limit;
+        }
+
+        // 清空缓冲区, 其中的切片随之释放
+        void resetOut(Buffer &out)
+        {
+            size_t bytes = out.pendingSize() - out.readAbleSize();
+            out.reset();
+            if (bytes > 0)
+            {
+                _slice_pending.fetch_sub(bytes, std::memory_order_relaxed);
+                _space.notifyAll();
+            }
+        }
+
+        // 切片没能写入队列: 归还它占用的未落地额度, 唤醒等待额度的生产者, 并计入丢弃
+        void dropSlice(Slice *slice, size_t len)
+        {
+            _slice_pending.fetch_sub(len, std::memory_order_relaxed);
+            _space.notifyAll();
+            slice->unref();
+            drop(1);
+        }
+
+        // 第一次丢弃时唤醒工作器, 由它按时交出统计
+        void drop(uint64_t n)
+        {
+            if (n == 0)
+                return;
+            _dropped_total.fetch_add(n, std::memory_order_relaxed);
+            if (_dropped.fetch_add(n, std::memory_order_relaxed) == 0)
+                wake();
+        }
+
+        // 环形缓冲区/线程队列模式下生产者不能移动读位置, 不支持 DROP_OLDEST
+        static OverflowPolicy checkOverflow(const AsyncOptions &options)
+        {
+            if (options._overflow == OverflowPolicy::DROP_OLDEST &&
+                (options._type == AsyncType::ASYNC_LOCKFREE || options._type == AsyncType::ASYNC_PERTHREAD))
+                throw std::invalid_argument("OverflowPolicy::DROP_OLDEST requires ASYNC_SAFE or ASYNC_UNSAFE");
+            return options._overflow;
+        }
+
+        // 各模式下生产端缓冲区的容量
+        static size_t queueCapacity(const AsyncOptions &options)
+        {
+            return options._type == AsyncType::ASYNC_LOCKFREE    ? DEFAULT_RING_SIZE
+                   : options._type == AsyncType::ASYNC_PERTHREAD ? DEFAULT_SPSC_SIZE
+                                                                  : DEFAULT_BUFFER_SIZE;
+        }
+
+        // 最小批量不能超过缓冲区容量的一半, 否则生产者可能在攒批期间一直等待空间
+        static size_t minBatch(const AsyncOptions &options)
+        {
+            size_t min_batch = std::min(options._min_batch, queueCapacity(options) / 2);
+            if (options._max_batch > 0)
+                min_batch = std::min(min_batch, options._max_batch);
+            return min_batch;
+        }
+
+        // 待处理数据 pending 字节是否可以交给回调: 攒够最小批量, 或者已经等待超过最大延迟
+        //  不可以时通过 wait 返回还需要等待的时间
+        //  有生产者在等待空间时不再攒批, 否则 _min_batch 等于 _max_batch 时生产者会一直等到超时
+        bool batchReady(size_t pending, std::chrono::nanoseconds &wait)
+        {
+            if (pending >= _min_batch || _flush_ns == 0 || _stop || _pro_waiting.load(std::memory_order_relaxed) > 0)
+            {
+                _batch_start = 0;
+                return true;
+            }
+            uint64_t now = util::Date::monoNs();
+            if (_batch_start == 0)
+                _batch_start = now;
+            if (now - _batch_start >= _flush_ns)
+            {
+                _batch_start = 0;
+                return true;
+            }
+            wait = std::chrono::nanoseconds(_batch_start + _flush_ns - now);
+            return false;
+        }
+
+        // 无锁模式: 写入环形缓冲区, 只有消费者在睡眠时才需要唤醒
+        void pushLockFree(const char *data, size_t len, LogLevel::value level)
+        {
+            if (!_ring.hasSpace(len) && !queueWait(_ring, len, level))
+                return drop(1);
+            // 超过环形缓冲区容量的日志无法写入, 同样计入丢弃
+            if (!_ring.push(data, len, [this, len](size_t pending)
+                            { published(pending, len); }, RingBuffer::levelFlags(level)))
+                drop(1);
+        }
+
+        // 归并用的时间戳: 优先使用日志中打印的时间戳, 使输出顺序与打印的时间一致; 不归并时为 0
+        uint64_t mergeStamp(uint64_t stamp)
+        {
+            if (_reorder_ns == 0)
+                return 0;
+            return stamp > 0 ? stamp : util::Date::realNs();
+        }
+
+        // 线程队列模式: 写入当前线程独占的队列
+        void pushPerThread(const char *data, size_t len, LogLevel::value level, uint64_t stamp)
+        {
+            stamp = mergeStamp(stamp);
+            SpscRing *q = localQueue();
+            if (q == nullptr)
+                return drop(1);
+            // 等待空间期间, 工作线程不会越过这条记录的时间戳输出其他队列的记录
+            q->hold(stamp);
+            if (!q->hasSpace(len) && !queueWait(*q, len, level))
+            {
+                q->hold(0);
+                return drop(1);
+            }
+            if (!q->push(data, len, stamp, [this, len](size_t pending)
+                         { published(pending, len); }, SpscRing::levelFlags(level)))
+            {
+                q->hold(0);
+                drop(1);
+            }
+        }
+
+        // 线程局部的队列表, 线程退出时关闭自己的所有队列
+        struct ThreadQueues
+        {
+            std::vector<std::pair<uint64_t, std::shared_ptr<SpscRing>>> _queues;
+            ~ThreadQueues()
+            {
+                for (auto &q : _queues)
+                    q.second->close();
+            }
+        };
+
+        static ThreadQueues &threadQueues()
+        {
+            static thread_local ThreadQueues queues;
+            return queues;
+        }
+
+        static uint64_t nextSerial()
+        {
+            static std::atomic<uint64_t> serial(0);
+            return serial.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // 获取当前线程在本工作器上的队列, 第一次写入时创建并注册
+        //  内存预算连最小的队列都放不下时返回空, 调用者将日志计入丢弃, 下次写入时再尝试创建
+        SpscRing *localQueue()
+        {
+            auto &queues = threadQueues()._queues;
+            for (auto &q : queues)
+                if (q.first == _serial)
+                    return q.second.get();
+            // 顺便清理已经停止的工作器留下的队列
+            queues.erase(std::remove_if(queues.begin(), queues.end(),
+                                        [](const std::pair<uint64_t, std::shared_ptr<SpscRing>> &q)
+                                        { return q.second->closed(); }),
+                         queues.end());
+            SpscRing::ptr q = SpscRing::create(DEFAULT_SPSC_SIZE, _memory);
+            if (!q)
+                return nullptr;
+            {
+                std::unique_lock<std::mutex> lock(_queue_mutex);
+                _queues.push_back(q);
+            }
+            _queue_version.fetch_add(1, std::memory_order_release);
+            queues.emplace_back(_serial, q);
+            return q.get();
+        }
+
+        bool urgent() { return _urgent_size.load(std::memory_order_relaxed) > 0; }
+
+        // 工作器处理一轮的结果
+        enum class StepResult
+        {
+            WORKED, // 交给了回调一批数据, 可以继续处理
+            IDLE,   // 暂时没有可处理的数据, 等待 ready() 成立或者 _idle_wait 超时
+            DONE    // 已经停止且所有数据都处理完了
+        };
+
+        // 处理一轮数据: 独占工作线程与线程池都通过它驱动工作器, out 为工作器自己的消费缓冲区 _con_buf
+        //  同一时刻只有一个线程在处理同一个工作器, 日志的先后顺序不变
+        //  双缓冲区模式下 out 与生产缓冲区交换, 两者的容量与内存分配方式始终留在这个工作器中
+        StepResult step(Buffer &out)
         {
+            drainUrgent();
+            StepResult r = _looper_type == AsyncType::ASYNC_LOCKFREE    ? lockFreeStep(out)
+                           : _looper_type == AsyncType::ASYNC_PERTHREAD ? perThreadStep(out)
+                                                                         : bufferStep(out);
+            if (r == StepResult::IDLE)
+                r = reportDropped(out);
+            if (r == StepResult::IDLE)
+                return runIdle();
+            if (r == StepResult::WORKED)
+                _idle_due = true;
+            // 退出前处理优先通道中剩余的日志, 并交出剩余的丢弃统计
+            if (r == StepResult::DONE)
+            {
+                drainUrgent();
+                if (_dropped.load(std::memory_order_relaxed) > 0)
+                    _callBack(out);
+            }
+            return r;
+        }
+
+        // 没有数据可处理时交出丢弃统计: 到了统计时间就交给回调一个空的批次, 否则把等待时间缩短到统计时间
+        StepResult reportDropped(Buffer &out)
+        {
+            if (_dropped.load(std::memory_order_relaxed) == 0)
+            {
+                _report_armed = false;
+                return StepResult::IDLE;
+            }
+            uint64_t now = util::Date::monoNs();
+            uint64_t at = _reported_at.load(std::memory_order_relaxed);
+            if (at == 0 || now - at >= _report_ns)
+            {
+                _report_armed = false;
+                _callBack(out);
+                // 回调没有取走统计时也推迟到下一个周期, 避免空转
+                if (_reported_at.load(std::memory_order_relaxed) == at)
+                    _reported_at.store(now, std::memory_order_relaxed);
+                return StepResult::WORKED;
+            }
+            _report_armed = true;
+            waitAtMost(std::chrono::nanoseconds(at + _report_ns - now));
+            return StepResult::IDLE;
+        }
+
+        // 没有数据可处理时调用空闲回调: 交出数据之后调用一次, 之后按回调要求的时间再调用
+        StepResult runIdle()
+        {
+            if (!_idle)
+                return StepResult::IDLE;
+            uint64_t now = util::Date::monoNs();
+            if (_idle_due || (_idle_at != 0 && now >= _idle_at))
+            {
+                _idle_due = false;
+                std::chrono::nanoseconds next = _idle();
+                _idle_at = next.count() > 0 ? now + next.count() : 0;
+            }
+            if (_idle_at != 0)
+                waitAtMost(std::chrono::nanoseconds(_idle_at - now));
+            return StepResult::IDLE;
+        }
+
+        // 返回 IDLE 之前缩短等待时间
+        void waitAtMost(std::chrono::nanoseconds left)
+        {
+            if (_idle_wait.count() == 0 || _idle_wait > left)
+                _idle_wait = left;
+        }
+
+        // 上一轮返回 IDLE 之后, 是否又有了值得处理的数据
+        //  有生产者在等待空间时不再攒批; 归并窗口内的等待(_idle_need 为 SIZE_MAX)除外, 此时再处理也输出不了记录
+        bool ready()
+        {
+            if (_idle_need != SIZE_MAX && _pro_waiting.load() > 0)
+                return true;
+            // 有新的丢弃还没有安排统计
+            if (!_report_armed && _dropped.load(std::memory_order_relaxed) > 0)
+                return true;
+            if (_looper_type == AsyncType::ASYNC_LOCKFREE)
+                return _idle_need <= 1 ? _ring.readable() : _ring.pending() >= _idle_need;
+            if (_looper_type == AsyncType::ASYNC_PERTHREAD)
+            {
+                // 有新的线程注册
+                if (_queue_version.load(std::memory_order_acquire) != _drain_version)
+                    return true;
+                size_t n = 0;
+                for (auto &q : _drain)
+                {
+                    if (_idle_need <= 1 && q->readable())
+                        return true;
+                    n += q->pending();
+                }
+                return _idle_need > 1 && n >= _idle_need;
+            }
+            return _pro_size.load(std::memory_order_relaxed) >= _idle_need;
+        }
+
+        // 记录 IDLE 时等待的条件: 待处理数据达到 need 字节, 或者等待 wait 之后(0 表示不超时)
+        StepResult idleUntil(size_t need, std::chrono::nanoseconds wait = std::chrono::nanoseconds(0))
+        {
+            _idle_need = need;
+            _idle_wait = wait;
+            return StepResult::IDLE;
+        }
+
+        // 没有数据时先自旋 _spin_ns, 仍然没有数据再睡眠, 直到 ready 成立/被唤醒/超时
+        //  生产者只有在工作线程声明睡眠之后才需要发起唤醒
+        void idle()
+        {
+            if (_spin_ns > 0)
+            {
+                uint64_t deadline = util::Date::monoNs() + _spin_ns;
+                // 单核机器上原地自旋只会拖住生产者, 改为让出CPU
+                static const bool single_core = std::thread::hardware_concurrency() == 1;
+                do
+                {
+                    if (single_core)
+                        std::this_thread::yield();
+                    else
+                        for (int i = 0; i < 64; ++i)
+                            detail::cpuRelax();
+                    if (_stop || urgent() || ready())
+                        return;
+                } while (util::Date::monoNs() < deadline);
+            }
+            _parker.prepare();
+            if (_stop || urgent() || ready())
+                return _parker.cancel();
+            _parker.park(_idle_wait);
+        }
+
+        // 生产者发布数据后唤醒工作器: 独占线程时唤醒工作线程, 否则交给线程池调度
+        void wake();
+
+        // 线程池调度状态: 返回 true 表示调用者需要把工作器放入线程池的就绪队列
+        //  工作器正在被处理时只做标记, 处理它的线程在返回 IDLE 之前会看到标记并再处理一轮
+        bool markReady()
+        {
+            // 与线程池处理工作器之前的屏障配对: 要么处理时看到新数据, 要么这里看到 POOL_RUNNING
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int s = _sched.load(std::memory_order_relaxed);
             while (1)
             {
-                // 判断生产缓冲区有无数据, 有则交换, 无则阻塞
+                if (s == POOL_IDLE)
+                {
+                    if (_sched.compare_exchange_weak(s, POOL_QUEUED))
+                        return true;
+                }
+                else if (s == POOL_RUNNING)
+                {
+                    if (_sched.compare_exchange_weak(s, POOL_NOTIFIED))
+                        return false;
+                }
+                else
+                    return false;
+            }
+        }
+
+        // 没有数据时将扩容后空闲超过 _shrink_ns 的缓冲区缩回初始容量
+        //  返回下次检查之前需要等待的时间, 0 表示没有需要归还的内存; 双缓冲区模式下需要持有 _mutex
+        std::chrono::nanoseconds shrinkIdle(Buffer &out)
+        {
+            if (_shrink_ns == 0)
+                return std::chrono::nanoseconds(0);
+            uint64_t wait = 0;
+            auto earliest = [&](uint64_t w)
+            {
+                if (w > 0 && (wait == 0 || w < wait))
+                    wait = w;
+            };
+            earliest(out.shrink(_shrink_ns));
+            earliest(_pro_buf.shrink(_shrink_ns));
+            earliest(_urgent_con.shrink(_shrink_ns));
+            {
+                std::unique_lock<std::mutex> lock(_urgent_mutex);
+                earliest(_urgent_buf.shrink(_shrink_ns));
+            }
+            return std::chrono::nanoseconds(wait);
+        }
+
+        // 无锁模式: 将已发布的记录连续拷贝到消费缓冲区后交给回调
+        StepResult lockFreeStep(Buffer &out)
+        {
+            std::chrono::nanoseconds wait(0);
+            size_t pending = _ring.pending();
+            if (pending > 0 && !batchReady(pending, wait))
+                return idleUntil(_min_batch, wait);
+            if (_ring.popTo(out, _max_batch) > 0)
+                _space.notifyAll();
+            if (out.empty())
+            {
+                // 退出标志被设置, 且所有预留的空间都已经消费完了再退出
+                if (_stop && _ring.empty())
+                    return StepResult::DONE;
+                return idleUntil(1, shrinkIdle(out));
+            }
+            _callBack(out);
+            resetOut(out);
+            return StepResult::WORKED;
+        }
+
+        // 线程队列模式: 轮流读取每个线程队列, 攒满一批后交给回调
+        StepResult perThreadStep(Buffer &out)
+        {
+            std::chrono::nanoseconds wait(0);
+            // 有新的线程注册, 更新快照
+            if (_queue_version.load(std::memory_order_acquire) != _drain_version)
+            {
+                std::unique_lock<std::mutex> lock(_queue_mutex);
+                _drain_version = _queue_version.load(std::memory_order_acquire);
+                _drain = _queues;
+            }
+            size_t bytes = 0;
+            for (auto &q : _drain)
+                bytes += q->pending();
+            if (bytes > 0 && !batchReady(bytes, wait))
+                return idleUntil(_min_batch, wait);
+            bool prune = false, pending = false;
+            for (auto &q : _drain)
+                prune = prune || q->closed();
+            if (_reorder_ns > 0)
+                pending = mergeQueues(out, _stop);
+            else
+            {
+                for (auto &q : _drain)
+                    q->popTo(out, _max_batch);
+            }
+            if (!out.empty())
+                _space.notifyAll();
+            // 有队列被关闭时, 移除其中数据已经读完的
+            if (prune)
+                pruneQueues();
+            if (out.empty() && pending)
+            {
+                // 剩下的记录都还在归并窗口内, 等待窗口过去或有新的数据
+                return idleUntil(SIZE_MAX, std::chrono::nanoseconds(_reorder_ns));
+            }
+            if (out.empty())
+            {
+                // 一轮下来没有读到数据, 且没有新注册的队列, 说明所有队列都是空的
+                if (_stop && _queue_version.load(std::memory_order_acquire) == _drain_version)
+                    return StepResult::DONE;
+                return idleUntil(1, shrinkIdle(out));
+            }
+            _callBack(out);
+            resetOut(out);
+            return StepResult::WORKED;
+        }
+
+        // 归并时各队列的队首记录, _data 为空表示所属线程正在写入的记录
+        struct MergeHead
+        {
+            uint64_t _stamp;
+            size_t _idx;
+            const char *_data;
+            uint32_t _len;
+            uint32_t _flags;
+        };
+
+        // 按日志打印的时间戳对各线程队列的记录做多路归并, 追加到消费缓冲区
+        //  某个队列为空时, 它之后可能还会出现更早的记录, 只有早于 (当前时间 - 窗口) 的记录才能输出
+        //  时间戳比当前时间还晚一个窗口以上, 说明系统时间被往回调整过, 直接输出, 不等待时间追上
+        //  队列为空但所属线程正在写入(例如等待空间)时, 以它公布的时间戳作为屏障, 不输出晚于它的记录
+        //  返回 true 表示还有记录在窗口内等待; flush 为 true 时忽略窗口, 全部输出
+        bool mergeQueues(Buffer &out, bool flush)
+        {
+            auto later = [](const MergeHead &a, const MergeHead &b)
+            { return a._stamp != b._stamp ? a._stamp > b._stamp : a._idx > b._idx; };
+            _merge_heap.clear();
+            size_t empty = 0;
+            for (size_t i = 0; i < _drain.size(); ++i)
+            {
+                MergeHead h;
+                h._idx = i;
+                if (mergeFront(h, flush))
+                    _merge_heap.push_back(h);
+                else
+                    ++empty;
+            }
+            std::make_heap(_merge_heap.begin(), _merge_heap.end(), later);
+            uint64_t now = util::Date::realNs();
+            uint64_t horizon = flush ? UINT64_MAX : now - _reorder_ns;
+            while (!_merge_heap.empty())
+            {
+                MergeHead h = _merge_heap.front();
+                // 最早的是正在写入的记录, 等它写入后再继续, 写入时会唤醒工作线程
+                if (h._data == nullptr)
+                    return true;
+                if (empty > 0 && h._stamp > horizon && h._stamp <= now + _reorder_ns)
+                    return true;
+                bool slice = (h._flags & SpscRing::SLICE_FLAG) != 0;
+                if (!slice && !out.empty() && (h._len > out.writeAbleSize() ||
+                                               out.readAbleSize() + h._len > _max_batch))
+                    return false;
+                std::pop_heap(_merge_heap.begin(), _merge_heap.end(), later);
+                _merge_heap.pop_back();
+                if (slice)
+                {
+                    Slice *p;
+                    memcpy(&p, h._data, sizeof(p));
+                    out.pushSlice(p);
+                }
+                else
+                    out.push(h._data, h._len);
+                out.raiseLevel(SpscRing::flagsLevel(h._flags));
+                _drain[h._idx]->pop(h._len);
+                if (mergeFront(h, flush))
+                {
+                    _merge_heap.push_back(h);
+                    std::push_heap(_merge_heap.begin(), _merge_heap.end(), later);
+                }
+                else
+                    ++empty;
+            }
+            return false;
+        }
+
+        // 读取队列 h._idx 的队首记录; 队列为空但所属线程正在写入时返回屏障(_data 为空), 都没有时返回 false
+        bool mergeFront(MergeHead &h, bool flush)
+        {
+            SpscRing &q = *_drain[h._idx];
+            if (q.front(h._data, h._len, h._stamp, h._flags))
+                return true;
+            if (flush)
+                return false;
+            // 先读 held 再读队首: 看到 held 被清除时, 它对应的记录一定已经可见
+            uint64_t held = q.held();
+            if (q.front(h._data, h._len, h._stamp, h._flags))
+                return true;
+            if (held == 0)
+                return false;
+            h._data = nullptr;
+            h._stamp = held;
+            return true;
+        }
+
+        // 移除所属线程已经退出且数据已经读完的队列
+        void pruneQueues()
+        {
+            auto done = [](const std::shared_ptr<SpscRing> &q)
+            { return q->closed() && !q->readable(); };
+            _drain.erase(std::remove_if(_drain.begin(), _drain.end(), done), _drain.end());
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _queues.erase(std::remove_if(_queues.begin(), _queues.end(), done), _queues.end());
+        }
+
+        // 双缓冲区模式: 生产缓冲区有数据则与消费缓冲区交换后交给回调
+        StepResult bufferStep(Buffer &out)
+        {
+            std::chrono::nanoseconds wait(0), shrink_wait(0);
+            size_t pending;
+            {
+                // 互斥锁的生命周期
+                std::unique_lock<std::mutex> lock(_mutex);
+                pending = _pro_buf.pendingSize();
+                if (pending > 0 && batchReady(pending, wait))
                 {
-                    // 互斥锁的生命周期
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    // 退出标志被设置, 且生产缓冲区已经没有数据了再退出
-                    if (_stop && _pro_buf.empty())
-                        break;
-
-                    _cond_con.wait(lock, [&]()
-                                   { return _stop || !_pro_buf.empty(); });
-                    _con_buf.swap(_pro_buf);
-                    // 唤醒生产者
-                    if (_looper_type == AsyncType::ASYNC_SAFE)
+                    out.swap(_pro_buf);
+                    _pro_count = 0;
+                    _pro_size.store(0, std::memory_order_relaxed);
+                    // 只有生产者在等待空间时才需要唤醒
+                    if (_pro_waiting > 0)
                         _cond_pro.notify_all();
                 }
-                // 唤醒后, 对消费缓冲区进行数据处理
-                _callBack(_con_buf);
-                // 初始化消费缓冲区
-                _con_buf.reset();
+                // 退出标志被设置, 且生产缓冲区已经没有数据了再退出
+                else if (pending == 0 && _stop)
+                    return StepResult::DONE;
+                // 没有数据时顺便归还扩容的内存, 生产缓冲区需要在锁内处理
+                else if (pending == 0)
+                    shrink_wait = shrinkIdle(out);
+            }
+            // 没有数据时等待数据到来, 数据不够一批时等待攒够或者超时
+            if (out.empty())
+                return pending == 0 ? idleUntil(1, shrink_wait) : idleUntil(_min_batch, wait);
+            // 对消费缓冲区进行数据处理
+            _callBack(out);
+            // 初始化消费缓冲区
+            resetOut(out);
+            return StepResult::WORKED;
+        }
+
+        // 独占工作线程的入口函数
+        void threadEntry()
+        {
+            while (1)
+            {
+                StepResult r = step(_con_buf);
+                if (r == StepResult::DONE)
+                    break;
+                if (r == StepResult::IDLE)
+                    idle();
             }
         }
 
     private:
         Functor _callBack;
+        IdleFunctor _idle; // 空闲回调, 落地方向在这里写出暂存的数据与定期落盘
 
     private:
         AsyncType _looper_type;
         std::atomic<bool> _stop; // 工作器停止标志
         Buffer _pro_buf;         // 生产缓冲区
-        Buffer _con_buf;         // 消费缓冲区
+        Buffer _con_buf;         // 消费缓冲区, 同一时刻只被处理工作器的线程使用
         std::mutex _mutex;
         std::condition_variable _cond_pro;
-        std::condition_variable _cond_con;
-        std::thread _thread; // 异步工作器对应的工作线程
+        std::atomic<size_t> _pro_size; // 生产缓冲区中的数据量
+        size_t _pro_count;            // 生产缓冲区中的日志条数
+        std::atomic<size_t> _pro_waiting; // 等待缓冲区空间的生产者数量, 包括环形缓冲区与线程队列
+        OverflowPolicy _overflow;     // 缓冲区满时的处理策略
+        std::chrono::milliseconds _overflow_timeout;
+        LogLevel::value _keep_level;
+        std::atomic<uint64_t> _dropped;       // 上次统计之后丢弃的日志条数
+        std::atomic<uint64_t> _dropped_total; // 累计丢弃的日志条数
+        uint64_t _report_ns;                  // 丢弃统计的间隔, 纳秒
+        std::atomic<uint64_t> _reported_at;   // 上次交出统计的时间, 0 表示还没有统计过
+        bool _report_armed;                   // 工作器已经按统计时间安排了定时, 只在处理工作器的线程中使用
+        Notifier _space;                      // 生产者等待环形缓冲区/线程队列/切片空间
+        LogLevel::value _priority_level;      // 不低于该等级的日志走优先通道
+        std::mutex _urgent_mutex;
+        Buffer _urgent_buf;                   // 优先通道的生产缓冲区, 容量固定
+        Buffer _urgent_con;                   // 优先通道的消费缓冲区
+        std::atomic<size_t> _urgent_size;     // 优先通道中待处理的数据量
+        size_t _urgent_count;                 // 优先通道生产缓冲区中的日志条数
+        std::condition_variable _urgent_cond; // 优先通道放不下时等待工作线程取走数据
+        Parker _parker;               // 工作线程的睡眠与唤醒
+        uint64_t _spin_ns;            // 睡眠前自旋的时间, 纳秒
+        uint64_t _flush_ns;           // 批量落地的最大延迟, 纳秒
+        uint64_t _shrink_ns;          // 缓冲区扩容后空闲多久缩容, 纳秒
+        size_t _min_batch;            // 最小批量字节数
+        size_t _max_batch;            // 最大批量字节数
+        uint64_t _batch_start;        // 工作线程开始攒批的时间, 0 表示没有在攒批
+        RingBuffer _ring;             // 无锁模式下的环形缓冲区
+        uint64_t _serial;               // 工作器编号, 用于在线程局部的队列表中查找
+        std::mutex _queue_mutex;        // 只保护线程队列的注册与移除
+        std::vector<std::shared_ptr<SpscRing>> _queues;
+        std::atomic<size_t> _queue_version; // 线程队列注册的次数
+        uint64_t _reorder_ns;               // 归并窗口, 纳秒
+        MemPolicy _memory;                  // 缓冲区的内存分配方式
+        size_t _slice_threshold;            // 使用切片的日志长度
+        size_t _slice_limit;                // 未落地切片的总字节数上限
+        std::atomic<size_t> _slice_pending; // 已写入还没有落地的切片字节数
+
+        std::vector<MergeHead> _merge_heap; // 只在处理工作器的线程中使用
+        std::vector<std::shared_ptr<SpscRing>> _drain; // 处理工作器的线程持有的队列快照
+        size_t _drain_version;                         // 快照对应的队列注册次数
+        size_t _idle_need;                    // 返回 IDLE 后, 待处理数据达到多少字节值得再处理
+        std::chrono::nanoseconds _idle_wait;  // 返回 IDLE 后最多等待的时间, 0 表示不超时
+        bool _idle_due;                       // 交出数据之后还没有调用过空闲回调
+        uint64_t _idle_at;                    // 空闲回调要求的下次调用时间, 0 表示不需要
+
+        // 线程池模式下的调度状态
+        static const int POOL_IDLE = 0;     // 没有在就绪队列中, 也没有被处理
+        static const int POOL_QUEUED = 1;   // 在就绪队列中等待处理
+        static const int POOL_RUNNING = 2;  // 正在被某个池线程处理
+        static const int POOL_NOTIFIED = 3; // 正在被处理, 期间有新的数据
+        std::shared_ptr<AsyncWorkerPool> _pool;
+        std::atomic<int> _sched;
+        uint64_t _timer_at; // 线程池中定时唤醒的时间, 由线程池的互斥锁保护
+        bool _finished;     // 线程池已经处理完停止的工作器, 由线程池的互斥锁保护
+        std::thread _thread; // 异步工作器独占的工作线程, 使用线程池时为空
+    };
+
+    /*
+        多个异步日志器共享的后台线程池
+            1. 工作器有数据时被放入就绪队列, 空闲的池线程取出后处理若干轮, 处理不完再排到队尾
+            2. 同一个工作器同一时刻只会被一个池线程处理 --> 每个日志器的输出顺序不变
+            3. 攒批/归并窗口需要的超时唤醒由池线程统一计时
+    */
+    class AsyncWorkerPool
+    {
+    public:
+        using ptr = std::shared_ptr<AsyncWorkerPool>;
+        AsyncWorkerPool(size_t threads = 1)
+            : _waiting(0), _stop(false)
+        {
+            for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+                _threads.emplace_back(&AsyncWorkerPool::threadEntry, this);
+        }
+
+        ~AsyncWorkerPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            for (auto &t : _threads)
+                t.join();
+        }
+
+        size_t size() const { return _threads.size(); }
+
+        // 进程内默认的共享线程池, 只有一个线程
+        static ptr shared()
+        {
+            static ptr pool = std::make_shared<AsyncWorkerPool>(1);
+            return pool;
+        }
+
+    private:
+        friend class AsyncLooper;
+
+        // 每次取出工作器后最多连续处理的轮数, 之后排到队尾, 避免一个繁忙的日志器占住池线程
+        static const size_t QUANTUM = 16;
+
+        void submit(AsyncLooper *looper)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _ready.push_back(looper);
+            if (_waiting > 0)
+                _cond.notify_one();
+        }
+
+        // 工作器处理完停止前的数据, 移除它的定时唤醒, 通知等待它的线程
+        void finish(AsyncLooper *looper)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _timers.erase(std::remove_if(_timers.begin(), _timers.end(),
+                                         [looper](const Timer &t)
+                                         { return t.second == looper; }),
+                          _timers.end());
+            std::make_heap(_timers.begin(), _timers.end(), std::greater<Timer>());
+            looper->_finished = true;
+            _done.notify_all();
+        }
+
+        void waitFinished(AsyncLooper *looper)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [looper]()
+                       { return looper->_finished; });
+        }
+
+        // 在 deadline 唤醒工作器; 已经有更早的定时唤醒时忽略
+        void addTimer(AsyncLooper *looper, uint64_t deadline)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (looper->_timer_at != 0 && looper->_timer_at <= deadline)
+                return;
+            looper->_timer_at = deadline;
+            _timers.emplace_back(deadline, looper);
+            std::push_heap(_timers.begin(), _timers.end(), std::greater<Timer>());
+            // 新的定时可能比等待中的池线程的超时更早
+            if (_waiting > 0)
+                _cond.notify_one();
+        }
+
+        // 取出下一个需要处理的工作器, 线程池停止时返回空
+        AsyncLooper *next()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (1)
+            {
+                uint64_t now = util::Date::monoNs();
+                while (!_timers.empty() && _timers.front().first <= now)
+                {
+                    Timer t = _timers.front();
+                    std::pop_heap(_timers.begin(), _timers.end(), std::greater<Timer>());
+                    _timers.pop_back();
+                    // 被更早的定时取代的过期项
+                    if (t.second->_timer_at != t.first)
+                        continue;
+                    t.second->_timer_at = 0;
+                    if (t.second->markReady())
+                        _ready.push_back(t.second);
+                }
+                if (!_ready.empty())
+                {
+                    AsyncLooper *looper = _ready.front();
+                    _ready.pop_front();
+                    return looper;
+                }
+                if (_stop)
+                    return nullptr;
+                ++_waiting;
+                if (_timers.empty())
+                    _cond.wait(lock);
+                else
+                    _cond.wait_for(lock, std::chrono::nanoseconds(_timers.front().first - now));
+                --_waiting;
+            }
+        }
+
+        // 池线程借用工作器自己的消费缓冲区, 不同日志器之间不交换缓冲区
+        void run(AsyncLooper *looper)
+        {
+            Buffer &out = looper->_con_buf;
+            size_t rounds = 0;
+            while (1)
+            {
+                // 与 markReady 中的屏障配对
+                looper->_sched.store(AsyncLooper::POOL_RUNNING, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                AsyncLooper::StepResult r = looper->step(out);
+                if (r == AsyncLooper::StepResult::DONE)
+                    return finish(looper);
+                if (r == AsyncLooper::StepResult::WORKED)
+                {
+                    if (++rounds < QUANTUM)
+                        continue;
+                    // 还有数据, 排到队尾让其他日志器也得到处理
+                    looper->_sched.store(AsyncLooper::POOL_QUEUED);
+                    return submit(looper);
+                }
+                // 定时唤醒在放弃工作器之前登记, 保证 finish 能够将其移除
+                if (looper->_idle_wait.count() > 0)
+                    addTimer(looper, util::Date::monoNs() + looper->_idle_wait.count());
+                int s = AsyncLooper::POOL_RUNNING;
+                if (looper->_sched.compare_exchange_strong(s, AsyncLooper::POOL_IDLE))
+                    return;
+                // 处理期间有新的数据, 再处理一轮
+            }
+        }
+
+        void threadEntry()
+        {
+            while (AsyncLooper *looper = next())
+                run(looper);
+        }
+
+    private:
+        using Timer = std::pair<uint64_t, AsyncLooper *>;
+        std::mutex _mutex;
+        std::condition_variable _cond; // 池线程等待就绪的工作器
+        std::condition_variable _done; // 等待工作器停止
+        std::deque<AsyncLooper *> _ready;
+        std::vector<Timer> _timers; // 按唤醒时间排列的小顶堆
+        size_t _waiting;            // 等待中的池线程数量
+        bool _stop;
+        std::vector<std::thread> _threads;
     };
+
+    inline void AsyncLooper::wake()
+    {
+        if (!_pool)
+            return _parker.unpark();
+        if (markReady())
+            _pool->submit(this);
+    }
+
+    inline void AsyncLooper::stop()
+    {
+        _stop = true;
+        if (_pool)
+        {
+            // 等待线程池处理完剩余的数据
+            wake();
+            _pool->waitFinished(this);
+        }
+        else
+        {
+            _parker.unpark(); // 唤醒工作线程
+            _thread.join();   // 等待工作线程退出
+        }
+        // 关闭所有线程队列, 生产者线程下次写入时会清理掉
+        std::unique_lock<std::mutex> lock(_queue_mutex);
+        for (auto &q : _queues)
+            q->close();
+    }
 } // namespace zx
 
 #endif
\ No newline at end of file
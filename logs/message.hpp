@@ -7,12 +7,15 @@
         5. 线程ID  --> 用于过滤出错的线程
         6. 日志主体消息
         7. 日志器名称 --> 当前支持多日志器的同时使用
+    其中 源文件名称/行号/等级/格式化字符串 在每个调用点都是固定的, 由调用点的静态描述符 LogSite 保存,
+    LogMsg 只保存指向它的指针
 */
 #ifndef __M_MSG_H__
 #define __M_MSG_H__
 
 #include "util.hpp"
 #include "level.hpp"
+#include "payload.hpp"
 #include <iostream>
 #include <string>
 #include <thread>
@@ -20,24 +23,77 @@
 
 namespace zx
 {
-    struct LogMsg
+    // 调用点静态描述符 --> 每个日志宏调用点在编译期生成一个, 地址即为调用点的唯一标识
+    struct LogSite
     {
-        time_t _ctime;          // 日志产生的时间戳
+        const char *_file;      // 源文件名称 (__FILE__)
+        const char *_basename;  // 源文件名 --> 编译期去掉目录部分
         size_t _line;           // 源代码行号
-        std::thread::id _tid;   // 线程ID
-        std::string _logger;    // 日志器名称
-        std::string _file;      // 源文件名称
-        std::string _payload;   // 日志主体消息
         LogLevel::value _level; // 日志等级
+        const char *_fmt;       // 格式化字符串
+
+        constexpr LogSite(const char *file, size_t line, LogLevel::value level, const char *fmt)
+            : _file(file), _basename(util::File::basename(file)), _line(line), _level(level), _fmt(fmt) {}
+    };
+
+    // 携带编译期参数个数的调用点描述符引用, 由宏 ZX_SITE 构造
+    //  N 为 RUNTIME_FMT 时描述符中没有格式化字符串, 使用调用时传入的 fmt
+    template <size_t N>
+    class LogSiteRef
+    {
+    public:
+        LogSiteRef(const LogSite *site, const char *fmt) : _site(site), _fmt(fmt) {}
+        const LogSite *site() const { return _site; }
+        const char *fmt() const { return _fmt; }
+
+    private:
+        const LogSite *_site;
+        const char *_fmt;
+    };
+
+    // 格式化字符串是编译期常量的字符串字面量 --> 否则按运行时的格式化字符串处理, 不放入描述符
+#if defined(__GNUC__)
+#define ZX_FMT_LITERAL(fmt) (zx::IsFmtLiteral<decltype((fmt))>::value && __builtin_constant_p(fmt))
+#else
+#define ZX_FMT_LITERAL(fmt) (zx::IsFmtLiteral<decltype((fmt))>::value)
+#endif
+
+    // 调用点的描述符是 lambda 中的静态常量, 每个调用点各自一份, 编译期完成初始化
+    //  ZX_FMT_LITERAL 不成立时 fmt 只在 runtimeFmt 中求值一次
+#define ZX_SITE(level, fmt)                                                                               \
+    zx::LogSiteRef<ZX_FMT_LITERAL(fmt) ? zx::fmtArgCount(zx::literalFmt(fmt)) : zx::RUNTIME_FMT>(         \
+        [&]() -> const zx::LogSite * {                                                                    \
+            static constexpr zx::LogSite site(__FILE__, __LINE__, zx::LogLevel::value::level,             \
+                                              ZX_FMT_LITERAL(fmt) ? zx::literalFmt(fmt) : nullptr);       \
+            return &site; }(),                                                                            \
+        zx::runtimeFmt(fmt))
+
+    struct LogMsg
+    {
+        const LogSite *_site;   // 调用点描述符: 源文件名称/行号/日志等级
+        time_t _ctime;          // 日志产生的时间戳 (秒)
+        uint32_t _nsec;         // 日志产生时间的纳秒部分
+        std::thread::id _tid;   // 线程ID
+        const char *_logger;    // 日志器名称 --> 指向日志器自身保存的名称
+        const char *_payload;   // 日志主体消息 --> 指向调用线程的格式化缓冲区, 不做拷贝
+        size_t _payload_len;    // 日志主体消息长度
 
         // 构造函数
-        LogMsg(LogLevel::value level,
-               const std::string file, size_t line,
-               const std::string logger,
-               const std::string msg) : _ctime(util::Date::now()), _level(level),
-                                        _line(line), _tid(std::this_thread::get_id()),
-                                        _file(file), _logger(logger), _payload(msg) {}
+        LogMsg(const LogSite *site, const char *logger,
+               const char *msg, size_t msg_len) : LogMsg(site, logger, msg, msg_len,
+                                                         util::Date::nowSpec(), std::this_thread::get_id()) {}
+
+        // 延迟格式化模式下, 时间与线程ID来自生产者线程写入的记录
+        LogMsg(const LogSite *site, const char *logger,
+               const char *msg, size_t msg_len,
+               const struct timespec &ctime, std::thread::id tid) : _site(site), _ctime(ctime.tv_sec),
+                                                                    _nsec((uint32_t)ctime.tv_nsec),
+                                                                    _tid(tid), _logger(logger),
+                                                                    _payload(msg), _payload_len(msg_len) {}
+
+        // 日志产生时间的纳秒数, 即打印出来的时间戳
+        uint64_t stampNs() const { return (uint64_t)_ctime * 1000000000ull + _nsec; }
     };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,196 @@
+/*
+    异步工作线程的睡眠与唤醒
+        1. 工作线程睡眠前先声明自己要睡眠, 生产者只在看到该声明时才发起唤醒
+            --> 工作线程醒着的时候, 写日志不会产生任何唤醒的系统调用
+        2. Linux 下直接在状态字上使用 futex, 其他平台退化为 互斥锁 + 条件变量
+*/
+#ifndef __M_PARKER_H__
+#define __M_PARKER_H__
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
+#include "util.hpp"
+#ifdef __linux__
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace zx
+{
+    namespace detail
+    {
+        // 自旋等待时降低对流水线与超线程兄弟核的占用
+        inline void cpuRelax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+    } // namespace detail
+
+    class Parker
+    {
+    public:
+        Parker() : _state(AWAKE) {}
+
+        // 工作线程声明即将睡眠, 之后必须再检查一次条件: 条件成立则 cancel, 否则 park
+        void prepare()
+        {
+            _state.store(SLEEPING, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        void cancel() { _state.store(AWAKE, std::memory_order_relaxed); }
+
+        // 睡眠直到被唤醒或超时, timeout 为 0 表示不超时; 可能提前返回, 调用者需要重新检查条件
+        void park(std::chrono::nanoseconds timeout)
+        {
+#ifdef __linux__
+            struct timespec ts, *pts = nullptr;
+            if (timeout.count() > 0)
+            {
+                ts.tv_sec = timeout.count() / 1000000000;
+                ts.tv_nsec = timeout.count() % 1000000000;
+                pts = &ts;
+            }
+            // 状态已经被生产者改回 AWAKE 时立即返回
+            syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAIT_PRIVATE, SLEEPING, pts, nullptr, 0);
+#else
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto woken = [&]()
+            { return _state.load(std::memory_order_relaxed) != SLEEPING; };
+            if (timeout.count() > 0)
+                _cond.wait_for(lock, timeout, woken);
+            else
+                _cond.wait(lock, woken);
+#endif
+            _state.store(AWAKE, std::memory_order_relaxed);
+        }
+
+        // 生产者在发布数据之后调用, 工作线程醒着时只有一次读操作
+        void unpark()
+        {
+            // 与 prepare 中的屏障配对: 要么工作线程看到新数据, 要么这里看到 SLEEPING
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_state.load(std::memory_order_relaxed) != SLEEPING)
+                return;
+            if (_state.exchange(AWAKE) != SLEEPING)
+                return;
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+            }
+            _cond.notify_one();
+#endif
+        }
+
+    private:
+        static const int AWAKE = 0;
+        static const int SLEEPING = 1;
+
+        std::atomic<int> _state;
+#ifndef __linux__
+        std::mutex _mutex;
+        std::condition_variable _cond;
+#endif
+    };
+
+    /*
+        多个生产者等待同一个条件(缓冲区空间)时的睡眠与唤醒
+            1. 等待者先登记再检查条件, 条件不成立才睡眠; 工作线程释放空间后只在有等待者时发起唤醒
+            2. Linux 下在代数计数上使用 futex, 唤醒时计数加一, 睡眠前读到的计数已经变化则立即返回
+    */
+    class Notifier
+    {
+    public:
+        Notifier() : _gen(0), _waiters(0) {}
+
+        // 等待 fits 成立, deadline 为单调时钟的纳秒数, 0 表示不超时; 返回 fits 是否成立
+        template <typename F>
+        bool waitUntil(const F &fits, uint64_t deadline)
+        {
+            _waiters.fetch_add(1);
+            // 与 notifyAll 中的屏障配对: 要么这里看到释放的空间, 要么工作线程看到等待者
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool ok = fits();
+            while (!ok)
+            {
+                int gen = _gen.load(std::memory_order_acquire);
+                if ((ok = fits()))
+                    break;
+                int64_t left = 0;
+                if (deadline > 0)
+                {
+                    left = (int64_t)(deadline - util::Date::monoNs());
+                    if (left <= 0)
+                        break;
+                }
+                wait(gen, std::chrono::nanoseconds(left));
+                ok = fits();
+            }
+            _waiters.fetch_sub(1, std::memory_order_relaxed);
+            return ok;
+        }
+
+        // 释放空间之后调用, 没有等待者时只有一次读操作
+        void notifyAll()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_waiters.load(std::memory_order_relaxed) == 0)
+                return;
+#ifdef __linux__
+            _gen.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, reinterpret_cast<int *>(&_gen), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _gen.fetch_add(1, std::memory_order_release);
+            }
+            _cond.notify_all();
+#endif
+        }
+
+    private:
+        // 计数仍然是 gen 时睡眠, 直到被唤醒或超时, timeout 为 0 表示不超时
+        void wait(int gen, std::chrono::nanoseconds timeout)
+        {
+#ifdef __linux__
+            struct timespec ts, *pts = nullptr;
+            if (timeout.count() > 0)
+            {
+                ts.tv_sec = timeout.count() / 1000000000;
+                ts.tv_nsec = timeout.count() % 1000000000;
+                pts = &ts;
+            }
+            syscall(SYS_futex, reinterpret_cast<int *>(&_gen), FUTEX_WAIT_PRIVATE, gen, pts, nullptr, 0);
+#else
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto woken = [&]()
+            { return _gen.load(std::memory_order_relaxed) != gen; };
+            if (timeout.count() > 0)
+                _cond.wait_for(lock, timeout, woken);
+            else
+                _cond.wait(lock, woken);
+#endif
+        }
+
+    private:
+        std::atomic<int> _gen;        // 唤醒的次数
+        std::atomic<size_t> _waiters; // 等待中的生产者数量
+#ifndef __linux__
+        std::mutex _mutex;
+        std::condition_variable _cond;
+#endif
+    };
+} // namespace zx
+
+#endif
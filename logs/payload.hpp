@@ -0,0 +1,284 @@
+/*
+    日志主体消息的格式化
+        1. 编译期统计格式化字符串中 {} 占位符的个数, 与参数个数进行校验
+        2. 将参数按类型直接追加到线程局部的缓冲区 FmtBuffer 中 --> 避免 vasprintf 每条日志都申请/释放一次内存
+        3. 兼容 printf 风格的格式化字符串
+*/
+#ifndef __M_PAYLOAD_H__
+#define __M_PAYLOAD_H__
+
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <cstdarg>
+#include <cstdint>
+#include <cinttypes>
+#include <limits>
+#include <type_traits>
+
+namespace zx
+{
+    // 不含 {} 占位符却含有 % 的格式化字符串, 按照 printf 风格处理
+    constexpr size_t PRINTF_STYLE = static_cast<size_t>(-1);
+    // 运行时才知道内容的格式化字符串(std::string, const char * 变量等), 按照 printf 风格处理
+    constexpr size_t RUNTIME_FMT = static_cast<size_t>(-2);
+
+    namespace detail
+    {
+        // 统计 {} 占位符的个数, {{ 为转义, 不计数
+        constexpr size_t countBraces(const char *s, size_t n)
+        {
+            return *s == '\0'                      ? n
+                   : (s[0] == '{' && s[1] == '{') ? countBraces(s + 2, n)
+                   : (s[0] == '{' && s[1] == '}') ? countBraces(s + 2, n + 1)
+                                                  : countBraces(s + 1, n);
+        }
+
+        constexpr bool hasPercent(const char *s)
+        {
+            return *s == '\0' ? false : (*s == '%' ? true : hasPercent(s + 1));
+        }
+    } // namespace detail
+
+    // 编译期得到格式化字符串需要的参数个数
+    constexpr size_t fmtArgCount(const char *s)
+    {
+        return (detail::countBraces(s, 0) == 0 && detail::hasPercent(s))
+                   ? PRINTF_STYLE
+                   : detail::countBraces(s, 0);
+    }
+
+    // 格式化字符串是否为字符串字面量 --> 只看类型, 是否为编译期常量由宏 ZX_FMT_LITERAL 再判断
+    template <typename T>
+    struct IsFmtLiteral : std::false_type
+    {
+    };
+    template <size_t N>
+    struct IsFmtLiteral<const char (&)[N]> : std::true_type
+    {
+    };
+
+    // 只在 ZX_FMT_LITERAL 成立时求值, 其他类型的重载只用于通过编译
+    constexpr const char *literalFmt(const char *fmt) { return fmt; }
+    template <typename T>
+    constexpr const char *literalFmt(const T &) { return nullptr; }
+
+    // 运行时的格式化字符串
+    inline const char *runtimeFmt(const char *fmt) { return fmt; }
+    inline const char *runtimeFmt(const std::string &fmt) { return fmt.c_str(); }
+
+    // 格式化使用的字符缓冲区 --> 只在空间不足时扩容, 追加数据时不做多余的初始化与检查
+    //  也可以直接写入外部的一段内存(如异步缓冲区中预留的空间), 写满时才拷贝到自己申请的内存中继续写
+    class FmtBuffer
+    {
+    public:
+        FmtBuffer() : _data(nullptr), _size(0), _capacity(0), _external(false) {}
+        FmtBuffer(char *data, size_t capacity) : _data(data), _size(0), _capacity(capacity), _external(true) {}
+        ~FmtBuffer()
+        {
+            if (!_external)
+                free(_data);
+        }
+        FmtBuffer(const FmtBuffer &) = delete;
+        FmtBuffer &operator=(const FmtBuffer &) = delete;
+
+        const char *data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        // 数据是否仍然在构造时传入的外部内存中
+        bool external() const { return _external; }
+        void clear() { _size = 0; }
+
+        // 获取至少 len 字节的可写空间, 写入后通过 commit 确认实际写入的长度
+        char *prepare(size_t len)
+        {
+            if (_size + len > _capacity)
+                grow(len);
+            return _data + _size;
+        }
+        void commit(size_t len) { _size += len; }
+
+        void append(const char *data, size_t len)
+        {
+            memcpy(prepare(len), data, len);
+            _size += len;
+        }
+        void append(const char *str) { append(str, strlen(str)); }
+        void append(const std::string &str) { append(str.data(), str.size()); }
+        void push_back(char c)
+        {
+            *prepare(1) = c;
+            _size += 1;
+        }
+
+    private:
+        void grow(size_t len)
+        {
+            size_t new_cap = _capacity == 0 ? 256 : _capacity * 2;
+            while (new_cap < _size + len)
+                new_cap *= 2;
+            char *p = (char *)realloc(_external ? nullptr : _data, new_cap);
+            if (p == nullptr)
+                throw std::bad_alloc();
+            if (_external)
+                memcpy(p, _data, _size);
+            _data = p;
+            _capacity = new_cap;
+            _external = false;
+        }
+
+    private:
+        char *_data;
+        size_t _size;
+        size_t _capacity;
+        bool _external;
+    };
+
+    // 每个线程复用同一块缓冲区, 稳定运行后不再申请内存
+    inline FmtBuffer &threadPayloadBuffer()
+    {
+        static thread_local FmtBuffer buf;
+        return buf;
+    }
+
+    // 各种类型参数的追加
+    inline void appendArg(FmtBuffer &out, const std::string &v) { out.append(v); }
+    inline void appendArg(FmtBuffer &out, const char *v) { out.append(v ? v : "(null)"); }
+    inline void appendArg(FmtBuffer &out, char *v) { appendArg(out, (const char *)v); }
+    inline void appendArg(FmtBuffer &out, char v) { out.push_back(v); }
+    inline void appendArg(FmtBuffer &out, bool v) { out.append(v ? "true" : "false"); }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    appendArg(FmtBuffer &out, T v)
+    {
+        char tmp[24];
+        char *end = tmp + sizeof(tmp), *p = end;
+        // 取绝对值时转为无符号, 避免最小值溢出
+        unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        do
+        {
+            *--p = (char)('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (v < 0)
+            *--p = '-';
+        out.append(p, end - p);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+    appendArg(FmtBuffer &out, T v)
+    {
+        char tmp[24];
+        char *end = tmp + sizeof(tmp), *p = end;
+        unsigned long long u = v;
+        do
+        {
+            *--p = (char)('0' + u % 10);
+            u /= 10;
+        } while (u);
+        out.append(p, end - p);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    appendArg(FmtBuffer &out, T v)
+    {
+        char tmp[32];
+        int n = snprintf(tmp, sizeof(tmp), "%.*g", std::numeric_limits<T>::digits10, (double)v);
+        out.append(tmp, n);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_enum<T>::value>::type
+    appendArg(FmtBuffer &out, T v)
+    {
+        appendArg(out, static_cast<typename std::underlying_type<T>::type>(v));
+    }
+
+    template <typename T>
+    void appendArg(FmtBuffer &out, T *v)
+    {
+        char tmp[24];
+        int n = snprintf(tmp, sizeof(tmp), "0x%" PRIxPTR, (uintptr_t)v);
+        out.append(tmp, n);
+    }
+
+    // 其他类型退化为 operator<< 输出, 需要临时的字符串流
+    template <typename T>
+    typename std::enable_if<std::is_class<T>::value>::type
+    appendArg(FmtBuffer &out, const T &v)
+    {
+        std::ostringstream ss;
+        ss << v;
+        out.append(ss.str());
+    }
+
+    namespace detail
+    {
+        // 追加格式化字符串中下一个 {} 之前的原始内容, 返回 {} 之后的位置
+        inline const char *appendUntilBraces(FmtBuffer &out, const char *fmt)
+        {
+            const char *start = fmt;
+            while (*fmt != '\0')
+            {
+                if ((fmt[0] == '{' || fmt[0] == '}') && fmt[1] == fmt[0])
+                {
+                    // {{ 与 }} 转义, 只保留一个字符
+                    out.append(start, fmt - start + 1);
+                    fmt += 2;
+                    start = fmt;
+                    continue;
+                }
+                if (fmt[0] == '{' && fmt[1] == '}')
+                {
+                    out.append(start, fmt - start);
+                    return fmt + 2;
+                }
+                ++fmt;
+            }
+            out.append(start, fmt - start);
+            return fmt;
+        }
+    } // namespace detail
+
+    // {} 风格的格式化 --> 参数个数已经在编译期校验过了
+    inline void formatPayload(FmtBuffer &out, const char *fmt)
+    {
+        detail::appendUntilBraces(out, fmt);
+    }
+
+    template <typename T, typename... Args>
+    void formatPayload(FmtBuffer &out, const char *fmt, const T &arg, const Args &...args)
+    {
+        fmt = detail::appendUntilBraces(out, fmt);
+        appendArg(out, arg);
+        formatPayload(out, fmt, args...);
+    }
+
+    // printf 风格的格式化, 先尝试写入栈上空间, 不够时再扩充线程缓冲区
+    inline bool vformatPayload(FmtBuffer &out, const char *fmt, va_list ap)
+    {
+        char tmp[512];
+        va_list cp;
+        va_copy(cp, ap);
+        int n = vsnprintf(tmp, sizeof(tmp), fmt, cp);
+        va_end(cp);
+        if (n < 0)
+            return false;
+        if ((size_t)n < sizeof(tmp))
+        {
+            out.append(tmp, n);
+            return true;
+        }
+        vsnprintf(out.prepare(n + 1), n + 1, fmt, ap);
+        out.commit(n);
+        return true;
+    }
+} // namespace zx
+
+#endif
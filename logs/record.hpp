@@ -0,0 +1,216 @@
+/*
+    延迟格式化模式下的二进制日志记录
+        1. 生产者线程只将 记录头 + 参数原始字节 写入异步缓冲区
+        2. 异步工作线程根据记录头中的解码函数还原参数, 再进行主体消息与日志格式的格式化
+    记录布局: [RecordHeader][参数1][参数2]...
+        整型/浮点/枚举/指针 --> 原始字节
+        字符串 --> uint32_t长度 + 字符数据
+        其他类型 --> 在生产者线程通过 operator<< 转成字符串后按字符串存储
+        printf 风格/已格式化的日志 --> 整体作为一个字符串存储
+*/
+#ifndef __M_RECORD_H__
+#define __M_RECORD_H__
+
+#include "message.hpp"
+#include <cstring>
+#include <thread>
+#include <ctime>
+
+namespace zx
+{
+    // 解码参数并按调用点的格式化字符串追加到 out 中
+    using DecodeFn = void (*)(FmtBuffer &out, const LogSite *site, const char *args);
+
+    struct RecordHeader
+    {
+        uint32_t _len;          // 整条记录的长度, 包含记录头
+        const LogSite *_site;   // 调用点描述符, 为空表示记录中已经是格式化完成的整条日志
+        DecodeFn _decode;       // 由参数类型实例化出的解码函数
+        struct timespec _ctime; // 日志产生的时间戳, 纳秒精度
+        std::thread::id _tid;   // 线程ID
+    };
+
+    // 单个参数的编解码 --> 默认按原始字节处理
+    template <typename T, typename Enable = void>
+    struct ArgCodec
+    {
+        static size_t size(const T &) { return sizeof(T); }
+        static char *encode(char *p, const T &v)
+        {
+            memcpy(p, &v, sizeof(T));
+            return p + sizeof(T);
+        }
+        static const char *decode(FmtBuffer &out, const char *p)
+        {
+            T v;
+            memcpy(&v, p, sizeof(T));
+            appendArg(out, v);
+            return p + sizeof(T);
+        }
+    };
+
+    // 字符串 --> 长度 + 字符数据
+    struct StrCodec
+    {
+        static size_t size(const char *, size_t len) { return sizeof(uint32_t) + len; }
+        static char *encode(char *p, const char *s, size_t len)
+        {
+            uint32_t n = (uint32_t)len;
+            memcpy(p, &n, sizeof(n));
+            memcpy(p + sizeof(n), s, len);
+            return p + sizeof(n) + len;
+        }
+        static const char *decode(FmtBuffer &out, const char *p)
+        {
+            uint32_t n;
+            memcpy(&n, p, sizeof(n));
+            out.append(p + sizeof(n), n);
+            return p + sizeof(n) + n;
+        }
+    };
+
+    template <>
+    struct ArgCodec<const char *>
+    {
+        static const char *str(const char *v) { return v ? v : "(null)"; }
+        static size_t size(const char *v) { return StrCodec::size(str(v), strlen(str(v))); }
+        static char *encode(char *p, const char *v) { return StrCodec::encode(p, str(v), strlen(str(v))); }
+        static const char *decode(FmtBuffer &out, const char *p) { return StrCodec::decode(out, p); }
+    };
+
+    template <>
+    struct ArgCodec<std::string>
+    {
+        static size_t size(const std::string &v) { return StrCodec::size(v.data(), v.size()); }
+        static char *encode(char *p, const std::string &v) { return StrCodec::encode(p, v.data(), v.size()); }
+        static const char *decode(FmtBuffer &out, const char *p) { return StrCodec::decode(out, p); }
+    };
+
+    // 将参数转换为可以按字节存储的形式 --> 其他类类型在生产者线程先格式化为字符串
+    template <typename T>
+    typename std::enable_if<!std::is_class<T>::value, const T &>::type
+    captureArg(const T &v) { return v; }
+
+    inline const std::string &captureArg(const std::string &v) { return v; }
+
+    template <typename T>
+    typename std::enable_if<std::is_class<T>::value, std::string>::type
+    captureArg(const T &v)
+    {
+        std::ostringstream ss;
+        ss << v;
+        return ss.str();
+    }
+
+    // 参数按退化后的类型进行编解码, char 数组与 char* 统一按 const char* 处理
+    template <typename T>
+    struct CodecType
+    {
+        using decay_type = typename std::decay<T>::type;
+        using type = typename std::conditional<std::is_same<decay_type, char *>::value,
+                                               const char *, decay_type>::type;
+    };
+
+    // 所有参数的编解码
+    template <typename... Args>
+    struct PayloadCodec;
+
+    template <>
+    struct PayloadCodec<>
+    {
+        static size_t size() { return 0; }
+        static char *encode(char *p) { return p; }
+        static void decode(FmtBuffer &out, const char *fmt, const char *)
+        {
+            formatPayload(out, fmt);
+        }
+    };
+
+    template <typename T, typename... Rest>
+    struct PayloadCodec<T, Rest...>
+    {
+        static size_t size(const T &v, const Rest &...rest)
+        {
+            return ArgCodec<T>::size(v) + PayloadCodec<Rest...>::size(rest...);
+        }
+        static char *encode(char *p, const T &v, const Rest &...rest)
+        {
+            return PayloadCodec<Rest...>::encode(ArgCodec<T>::encode(p, v), rest...);
+        }
+        static void decode(FmtBuffer &out, const char *fmt, const char *p)
+        {
+            fmt = detail::appendUntilBraces(out, fmt);
+            p = ArgCodec<T>::decode(out, p);
+            PayloadCodec<Rest...>::decode(out, fmt, p);
+        }
+    };
+
+    template <typename... Args>
+    void decodeArgs(FmtBuffer &out, const LogSite *site, const char *args)
+    {
+        PayloadCodec<Args...>::decode(out, site->_fmt, args);
+    }
+
+    inline void decodeFormatted(FmtBuffer &out, const LogSite *, const char *args)
+    {
+        StrCodec::decode(out, args);
+    }
+
+    // 每个线程复用同一块记录编码缓冲区
+    inline FmtBuffer &threadRecordBuffer()
+    {
+        static thread_local FmtBuffer buf;
+        return buf;
+    }
+
+    namespace detail
+    {
+        inline void fillHeader(RecordHeader &hdr, size_t len, const LogSite *site, DecodeFn decode)
+        {
+            hdr._len = (uint32_t)len;
+            hdr._site = site;
+            hdr._decode = decode;
+            hdr._ctime = util::Date::nowSpec();
+            hdr._tid = std::this_thread::get_id();
+        }
+    } // namespace detail
+
+    // 将一条日志的参数编码为二进制记录, 返回记录的长度, 记录存放在 out 中
+    template <typename... Args>
+    size_t encodeRecord(FmtBuffer &out, const LogSite *site, const Args &...args)
+    {
+        using Codec = PayloadCodec<typename CodecType<Args>::type...>;
+        RecordHeader hdr;
+        detail::fillHeader(hdr, sizeof(RecordHeader) + Codec::size(args...), site,
+                           &decodeArgs<typename CodecType<Args>::type...>);
+        out.clear();
+        char *p = out.prepare(hdr._len);
+        memcpy(p, &hdr, sizeof(hdr));
+        Codec::encode(p + sizeof(hdr), args...);
+        out.commit(hdr._len);
+        return hdr._len;
+    }
+
+    // 将已经格式化好的字符串编码为记录: site 为空时 data 是完整的一条日志, 否则是主体消息
+    inline size_t encodeFormatted(FmtBuffer &out, const LogSite *site, const char *data, size_t len)
+    {
+        RecordHeader hdr;
+        detail::fillHeader(hdr, sizeof(RecordHeader) + StrCodec::size(data, len), site, &decodeFormatted);
+        out.clear();
+        char *p = out.prepare(hdr._len);
+        memcpy(p, &hdr, sizeof(hdr));
+        StrCodec::encode(p + sizeof(hdr), data, len);
+        out.commit(hdr._len);
+        return hdr._len;
+    }
+
+    // 记录中保存的日志产生时间的纳秒数, 即解码后打印出来的时间戳
+    inline uint64_t recordStamp(const char *rec)
+    {
+        RecordHeader hdr;
+        memcpy(&hdr, rec, sizeof(hdr));
+        return util::Date::toNs(hdr._ctime);
+    }
+} // namespace zx
+
+#endif
@@ -8,7 +8,24 @@
 #define __M_SINK_H__
 
 #include "format.hpp"
-#include <fstream>
+#include "uring.hpp"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 namespace zx
 {
@@ -20,6 +37,19 @@ namespace zx
         LogSink() {}
         virtual ~LogSink() {}
         virtual void log(const char *data, size_t len) = 0;
+        // 按顺序写入多段不连续的日志, 默认逐段调用 log, 支持聚集写的落地方向可以重写为一次系统调用
+        virtual void logv(const struct iovec *iov, int cnt)
+        {
+            for (int i = 0; i < cnt; ++i)
+                log(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+        }
+        // 将已经写入的日志刷新到落地方向, 用于需要立即可见的高等级日志
+        virtual void flush() {}
+        // 一批日志写入之后调用, level 为其中最高的日志等级, 由落地方向按自己的持久化策略决定是否落盘
+        virtual void sync(LogLevel::value) {}
+        // 异步日志器的工作线程空闲时与同步日志器每条日志之后调用, 落地方向在这里写出暂存的数据, 处理到期的定期落盘
+        //  返回还需要多久再调用一次, 0 表示不需要
+        virtual std::chrono::nanoseconds idle() { return std::chrono::nanoseconds(0); }
     };
 
     /*
@@ -38,75 +68,618 @@ namespace zx
         {
             std::cout.write(data, len);
         }
+        void flush() { std::cout.flush(); }
     };
 
-    // 2. 指定文件
-    class FileSink : public LogSink
+    // 文件的持久化策略
+    enum class SyncPolicy
+    {
+        SYNC_NONE,     // 只写入内核页缓存, 何时落盘由内核决定
+        SYNC_PERIODIC, // 距离上次落盘超过 _interval 后落盘: 写入/flush 时检查, 异步日志器的工作线程空闲时也会按时检查
+        SYNC_ON_LEVEL  // 写入的一批日志中有不低于 _level 的日志时落盘
+    };
+
+    struct SyncOptions
+    {
+        SyncOptions(SyncPolicy policy = SyncPolicy::SYNC_NONE,
+                    std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+                    LogLevel::value level = LogLevel::value::ERROR)
+            : _policy(policy), _interval(interval), _level(level) {}
+
+        SyncPolicy _policy;
+        std::chrono::milliseconds _interval;
+        LogLevel::value _level;
+    };
+
+    /*
+        文件落地的后台辅助线程, 所有落地方向共享一个
+            1. 提前创建并打开滚动时要切换到的下一个文件, 滚动时只需要替换文件描述符
+            2. 滚动下来的旧文件在这里落盘并关闭, 不占用写日志的线程
+        任务按提交顺序执行; 最后一个使用者释放时执行完剩余的任务再退出
+    */
+    class FileHelper
     {
     public:
-        // 构造时传入文件名, 并打开文件, 将操作句柄给管理起来
-        FileSink(const std::string &pathname) : _pathname(pathname)
+        using ptr = std::shared_ptr<FileHelper>;
+        FileHelper() : _stop(false), _thread(&FileHelper::threadEntry, this) {}
+        ~FileHelper()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            _thread.join();
+        }
+
+        static ptr shared()
         {
-            // 1. 创建日志文件所在的目录
-            util::File::createDirectory(util::File::path(_pathname));
-            // 2. 创建并打开文件
-            _ofs.open(_pathname, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
+            static ptr helper = std::make_shared<FileHelper>();
+            return helper;
         }
-        // 将日志消息写入指定文件
+
+        void post(std::function<void()> task)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _tasks.push_back(std::move(task));
+            }
+            _cond.notify_one();
+        }
+
+    private:
+        void threadEntry()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait(lock, [&]()
+                               { return _stop || !_tasks.empty(); });
+                    if (_tasks.empty())
+                        return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::deque<std::function<void()>> _tasks;
+        bool _stop;
+        std::thread _thread;
+    };
+
+    /*
+        文件落地的公共部分, 直接使用文件描述符
+            1. 以 O_APPEND | O_CLOEXEC 打开, 不超过 STAGE_SIZE 的小块写入先暂存, 攒满后与新的数据一起一次 writev 写出
+                --> 异步日志器的小批次不再每批一次系统调用; 暂存的数据在 flush/高等级日志/工作线程空闲/切换文件时写出
+                --> 同步日志器每条日志之后都调用 idle, 不会有日志停留在暂存区中
+            2. 多段数据通过 writev 聚集写入, 处理 EINTR 与部分写入
+            3. 按 SyncOptions 用 fdatasync 落盘, 关闭文件之前落盘一次
+            4. 滚动文件通过 prepareFile/switchFile 由后台线程提前打开下一个文件, 旧文件交给后台线程落盘并关闭
+        写入失败(磁盘满等)时放弃这批日志, 不影响之后的写入
+        打开文件失败时不终止进程:
+            1. 新文件打开失败时继续写入当前的文件, 滚动文件到下一次滚动时再试
+            2. 没有可写入的文件时丢弃日志, 每秒重试一次打开
+    */
+    class FdSink : public LogSink
+    {
+    public:
+        FdSink(const SyncOptions &sync) : _fd(-1), _flags(0), _retry_at(0), _sync(sync),
+                                          _synced_at(util::Date::monoNs()), _dirty(false) {}
+        ~FdSink()
+        {
+            discardFile();
+            closeFile();
+        }
+
         void log(const char *data, size_t len)
         {
-            _ofs.write(data, len);
-            assert(_ofs.good());
+            struct iovec iov = {const_cast<char *>(data), len};
+            logv(&iov, 1);
+        }
+        void logv(const struct iovec *iov, int cnt)
+        {
+            size_t len = 0;
+            for (int i = 0; i < cnt; ++i)
+                len += iov[i].iov_len;
+            beforeWrite(len);
+            if (!reopenFile())
+                return;
+            if (_stage.size() + len <= STAGE_SIZE)
+            {
+                for (int i = 0; i < cnt; ++i)
+                    _stage.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+            }
+            else if (_stage.empty())
+                writeV(iov, cnt);
+            else
+            {
+                // 暂存的数据在前, 与这次的数据一起写出
+                _iov.clear();
+                struct iovec staged = {const_cast<char *>(_stage.data()), _stage.size()};
+                _iov.push_back(staged);
+                _iov.insert(_iov.end(), iov, iov + cnt);
+                writeV(_iov.data(), (int)_iov.size());
+                _stage.clear();
+            }
+            afterWrite();
+        }
+        // 不低于 _level 的日志立即写出, SYNC_ON_LEVEL 时同时落盘
+        void sync(LogLevel::value level)
+        {
+            if (level < _sync._level)
+                return;
+            if (_sync._policy == SyncPolicy::SYNC_ON_LEVEL)
+                dataSync();
+            else
+                writeStage();
+        }
+        void flush()
+        {
+            writeStage();
+            periodicSync();
+        }
+        std::chrono::nanoseconds idle()
+        {
+            writeStage();
+            return periodicSync();
+        }
+
+    protected:
+        // 写入 len 字节之前调用, 滚动文件在这里切换文件
+        virtual void beforeWrite(size_t) {}
+        // 落盘之前调用, 异步提交写入的子类在这里等待已提交的写入完成
+        virtual void settle() {}
+
+        // 打开(必要时创建)文件并换下已经打开的文件; 自己指定写入位置的子类不使用 O_APPEND
+        //  打开失败时返回 false, 继续使用已经打开的文件
+        bool openFile(const std::string &pathname, int flags = O_APPEND)
+        {
+            _path = pathname;
+            _flags = flags;
+            int fd = openPath(pathname, flags);
+            if (fd < 0)
+            {
+                _retry_at = util::Date::coarseNow() + 1;
+                return false;
+            }
+            closeFile();
+            _fd = fd;
+            return true;
+        }
+
+        // 没有打开的文件时重新打开 openFile 最后一次指定的文件, 每秒最多尝试一次; 返回是否有可写入的文件
+        bool reopenFile()
+        {
+            if (_fd >= 0)
+                return true;
+            if (_path.empty() || util::Date::coarseNow() < _retry_at)
+                return false;
+            return openFile(_path, _flags);
+        }
+
+        // 由后台线程生成文件名并打开文件, 之后由 switchFile 换上; prealloc 不为 0 时预先分配磁盘空间(不改变文件长度)
+        //  flags 为额外的打开标志, 预先以临时文件名创建的文件用 O_TRUNC 清掉上次异常退出留下的内容
+        void prepareFile(std::function<std::string()> name, size_t prealloc = 0, int flags = 0)
+        {
+            discardFile();
+            auto next = std::make_shared<std::promise<Prepared>>();
+            _next = next->get_future().share();
+            helper()->post([next, name, prealloc, flags]()
+                           {
+                Prepared file;
+                file._path = name();
+                file._fd = openPath(file._path, O_APPEND | flags);
+#ifdef FALLOC_FL_KEEP_SIZE
+                if (file._fd >= 0 && prealloc > 0)
+                    ::fallocate(file._fd, FALLOC_FL_KEEP_SIZE, 0, prealloc);
+#endif
+                next->set_value(file); });
+        }
+
+        // 换上 prepareFile 准备好的文件, 后台线程还没有打开时等待; 旧文件交给后台线程落盘并关闭
+        //  rename_to 不为空时, 换上之后由后台线程将文件改名为 rename_to() --> 用于以临时文件名预先创建的文件
+        //  准备的文件没能打开时返回 false, 继续使用当前的文件
+        bool switchFile(std::function<std::string()> rename_to = std::function<std::string()>())
+        {
+            assert(_next.valid());
+            Prepared file = _next.get();
+            _next = std::shared_future<Prepared>();
+            if (file._fd < 0)
+                return false;
+            writeStage();
+            settle();
+            int fd = _fd;
+            bool sync = _sync._policy != SyncPolicy::SYNC_NONE && _dirty;
+            if (fd >= 0)
+                helper()->post([fd, sync]()
+                               {
+                    if (sync)
+                        ::fdatasync(fd);
+                    ::close(fd); });
+            if (rename_to)
+            {
+                std::string path = file._path;
+                helper()->post([path, rename_to]()
+                               { ::rename(path.c_str(), rename_to().c_str()); });
+            }
+            _fd = file._fd;
+            _dirty = false;
+            return true;
+        }
+
+        // 放弃 prepareFile 准备的文件: 后台线程关闭它, 文件是空的就删除
+        void discardFile()
+        {
+            if (!_next.valid())
+                return;
+            std::shared_future<Prepared> next = _next;
+            _next = std::shared_future<Prepared>();
+            helper()->post([next]()
+                           {
+                const Prepared &file = next.get();
+                if (file._fd < 0)
+                    return;
+                struct stat st;
+                if (fstat(file._fd, &st) == 0 && st.st_size == 0)
+                    ::unlink(file._path.c_str());
+                ::close(file._fd); });
+        }
+
+        int fd() const { return _fd; }
+
+        void closeFile()
+        {
+            if (_fd < 0)
+                return;
+            writeStage();
+            if (_sync._policy != SyncPolicy::SYNC_NONE)
+                dataSync();
+            ::close(_fd);
+            _fd = -1;
+        }
+
+        // 写入之后调用, 处理定期落盘
+        void afterWrite()
+        {
+            _dirty = true;
+            periodicSync();
+        }
+
+        // 定期落盘的时间到了就落盘; 返回距离下次落盘还有多久, 0 表示没有需要落盘的数据
+        std::chrono::nanoseconds periodicSync()
+        {
+            if (_sync._policy != SyncPolicy::SYNC_PERIODIC || !_dirty)
+                return std::chrono::nanoseconds(0);
+            uint64_t interval = std::chrono::duration_cast<std::chrono::nanoseconds>(_sync._interval).count();
+            uint64_t elapsed = util::Date::monoNs() - _synced_at;
+            if (elapsed < interval)
+                return std::chrono::nanoseconds(interval - elapsed);
+            dataSync();
+            return std::chrono::nanoseconds(0);
+        }
+
+        void dataSync()
+        {
+            if (!_dirty)
+                return;
+            writeStage();
+            settle();
+            ::fdatasync(_fd);
+            _dirty = false;
+            _synced_at = util::Date::monoNs();
         }
 
     private:
-        std::string _pathname;
-        std::ofstream _ofs;
+        struct Prepared
+        {
+            int _fd;
+            std::string _path;
+        };
+
+        // 打开失败时返回 -1
+        static int openPath(const std::string &pathname, int flags)
+        {
+            util::File::createDirectory(util::File::path(pathname));
+            return ::open(pathname.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+        }
+
+        // 只有滚动文件用到后台线程, 第一次使用时才创建
+        const FileHelper::ptr &helper()
+        {
+            if (!_helper)
+                _helper = FileHelper::shared();
+            return _helper;
+        }
+
+        void writeStage()
+        {
+            if (_stage.empty())
+                return;
+            writeAll(_stage.data(), _stage.size());
+            _stage.clear();
+        }
+
+        void writeAll(const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t ret = ::write(_fd, data, len);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                if (ret <= 0)
+                    return;
+                data += ret;
+                len -= ret;
+            }
+        }
+
+        void writeV(const struct iovec *iov, int cnt)
+        {
+            while (cnt > 0)
+            {
+                int n = std::min(cnt, IOV_MAX);
+                ssize_t ret = ::writev(_fd, iov, n);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                if (ret < 0)
+                    return;
+                // 跳过已经完整写入的段, 部分写入的段单独写完剩余部分
+                size_t done = ret;
+                while (n > 0 && done >= iov->iov_len)
+                {
+                    done -= iov->iov_len;
+                    ++iov, --cnt, --n;
+                }
+                if (n == 0)
+                    continue;
+                if (ret == 0)
+                    return;
+                writeAll(static_cast<const char *>(iov->iov_base) + done, iov->iov_len - done);
+                ++iov, --cnt;
+            }
+        }
+
+    private:
+        static const size_t STAGE_SIZE = 8 * 1024; // 暂存小块写入的上限
+
+        int _fd;
+        std::string _path;  // openFile 最后一次指定的文件, 打开失败时用于重试
+        int _flags;
+        time_t _retry_at;   // 下一次重试打开的时间
+        SyncOptions _sync;
+        uint64_t _synced_at; // 上次落盘的时间
+        bool _dirty;         // 上次落盘之后是否有新的写入(包括暂存的数据)
+        FmtBuffer _stage;    // 暂存的小块写入
+        std::vector<struct iovec> _iov; // 暂存的数据与新数据一起写出时的 iovec
+        FileHelper::ptr _helper;
+        std::shared_future<Prepared> _next; // 后台线程准备的下一个文件
     };
 
-    // 3. 滚动文件 --> (以文件大小进行滚动)
-    class FileBySizeSink : public LogSink
+    // 2. 指定文件
+    class FileSink : public FdSink
     {
     public:
         // 构造时传入文件名, 并打开文件, 将操作句柄给管理起来
-        FileBySizeSink(const std::string &basename, size_t max_size)
-            : _basename(basename), _max_fsize(max_size), _cur_fsize(0), _name_count(0)
+        FileSink(const std::string &pathname, const SyncOptions &sync = SyncOptions())
+            : FdSink(sync), _pathname(pathname)
         {
-            std::string pathname = createNewFile();
-            // 1. 创建日志文件所在的目录
-            util::File::createDirectory(util::File::path(pathname));
-            // 2. 创建并打开文件
-            _ofs.open(pathname, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
+            openFile(_pathname);
         }
-        // 将日志消息写入指定文件
+
+    private:
+        std::string _pathname;
+    };
+
+    /*
+        基于 io_uring 的文件落地: 写入提交给内核之后立即返回, 慢速磁盘不会阻塞后台线程
+            1. 数据拷贝到空闲的写缓冲区后提交, 最多 depth 个缓冲区同时在途, 都在途时等待最早的完成
+            2. 内核完成写入之后才回收缓冲区; 收割在之后的写入中顺带完成, 不需要额外的线程
+            3. 每次写入带有显式的文件偏移, 在途的写入之间不依赖完成顺序 --> 文件不以 O_APPEND 打开
+            4. 不支持 io_uring 时退化为同步的 pwrite
+        刷新/落盘/析构之前等待所有在途的写入完成
+    */
+    class UringFileSink : public FdSink
+    {
+    public:
+        UringFileSink(const std::string &pathname, const SyncOptions &sync = SyncOptions(), size_t depth = 4)
+            : FdSink(sync), _pathname(pathname), _slots(std::max<size_t>(depth, 1)), _inflight(0)
+        {
+            _offset = openFile(_pathname, 0) ? ::lseek(fd(), 0, SEEK_END) : 0;
+            _ring.init((unsigned)_slots.size());
+        }
+        ~UringFileSink() { settle(); }
+
         void log(const char *data, size_t len)
         {
-            if (_cur_fsize > _max_fsize)
+            struct iovec iov = {const_cast<char *>(data), len};
+            logv(&iov, 1);
+        }
+        void logv(const struct iovec *iov, int cnt)
+        {
+            size_t len = 0;
+            for (int i = 0; i < cnt; ++i)
+                len += iov[i].iov_len;
+            if (len == 0)
+                return;
+            if (fd() < 0)
             {
-                // 关闭已经打开的文件
-                _ofs.close();
-                std::string pathname = createNewFile();
-                _ofs.open(pathname, std::ios::binary | std::ios::app);
-                assert(_ofs.is_open());
-                _cur_fsize = 0;
+                // 构造时没能打开文件, 重新打开之后从文件尾部接着写
+                if (!reopenFile())
+                    return;
+                _offset = ::lseek(fd(), 0, SEEK_END);
+            }
+            if (_ring.ok())
+            {
+                Slot &slot = freeSlot();
+                for (int i = 0; i < cnt; ++i)
+                    slot._buf.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+                slot._off = _offset;
+                slot._done = 0;
+                submit(slot);
+            }
+            else
+            {
+                uint64_t off = _offset;
+                for (int i = 0; i < cnt; ++i)
+                {
+                    pwriteAll(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len, off);
+                    off += iov[i].iov_len;
+                }
+            }
+            _offset += len;
+            afterWrite();
+        }
+        void flush()
+        {
+            settle();
+            FdSink::flush();
+        }
+
+    protected:
+        void settle()
+        {
+            while (_inflight > 0)
+                reapOne(true);
+        }
+
+    private:
+        struct Slot
+        {
+            Slot() : _off(0), _done(0), _busy(false) {}
+            FmtBuffer _buf; // 提交给内核的数据
+            uint64_t _off; // 数据在文件中的偏移
+            size_t _done;  // 已经完成写入的字节数
+            bool _busy;    // 是否在途
+        };
+
+        // 先收割已经完成的写入, 没有空闲的缓冲区时等待
+        Slot &freeSlot()
+        {
+            while (_inflight > 0 && reapOne(false))
+                ;
+            while (true)
+            {
+                for (auto &slot : _slots)
+                {
+                    if (!slot._busy)
+                        return slot;
+                }
+                reapOne(true);
+            }
+        }
+
+        // 提交缓冲区中还没有写入的部分; 提交失败时等待其它在途写入完成, 之后改为同步写入
+        void submit(Slot &slot)
+        {
+            const char *data = slot._buf.data() + slot._done;
+            size_t len = slot._buf.size() - slot._done;
+            uint64_t tag = &slot - &_slots[0];
+            if (_ring.ok() && _ring.write(fd(), data, len, slot._off + slot._done, tag))
+            {
+                slot._busy = true;
+                ++_inflight;
+                return;
+            }
+            settle();
+            _ring.close();
+            pwriteAll(data, len, slot._off + slot._done);
+            slot._buf.clear();
+        }
+
+        // 处理一个完成事件, wait 为 false 时没有完成事件返回 false
+        bool reapOne(bool wait)
+        {
+            uint64_t tag;
+            int res;
+            if (!_ring.reap(tag, res, wait))
+            {
+                // 等待失败说明环已经不可用, 在途的写入不会再有完成事件
+                if (wait)
+                    abandonRing();
+                return false;
+            }
+            Slot &slot = _slots[tag];
+            slot._busy = false;
+            --_inflight;
+            if (res == -EINTR || res == -EAGAIN)
+                res = 0;
+            else if (res < 0)
+            {
+                // 内核不支持该操作时改为同步写入, 其它错误放弃这批日志
+                if (res == -EINVAL || res == -EOPNOTSUPP)
+                {
+                    settle();
+                    _ring.close();
+                    pwriteAll(slot._buf.data() + slot._done, slot._buf.size() - slot._done, slot._off + slot._done);
+                }
+                slot._buf.clear();
+                return true;
+            }
+            slot._done += res;
+            // 部分写入时提交剩余部分
+            if (slot._done < slot._buf.size())
+                submit(slot);
+            else
+                slot._buf.clear();
+            return true;
+        }
+
+        // 关闭不可用的环, 在途缓冲区中没有确认写入的部分改为同步写入, 之后的写入都走 pwrite
+        //  按偏移写入是幂等的, 内核其实已经写完的部分再写一次不会改变文件内容
+        void abandonRing()
+        {
+            _ring.close();
+            for (auto &slot : _slots)
+            {
+                if (!slot._busy)
+                    continue;
+                slot._busy = false;
+                pwriteAll(slot._buf.data() + slot._done, slot._buf.size() - slot._done, slot._off + slot._done);
+                slot._buf.clear();
+            }
+            _inflight = 0;
+        }
+
+        void pwriteAll(const char *data, size_t len, uint64_t off)
+        {
+            while (len > 0)
+            {
+                ssize_t ret = ::pwrite(fd(), data, len, off);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                if (ret <= 0)
+                    return;
+                data += ret;
+                len -= ret;
+                off += ret;
             }
-            _ofs.write(data, len);
-            assert(_ofs.good());
-            _cur_fsize += len;
         }
 
     private:
-        // 判断文件大小, 超过指定大小就创建新文件
-        std::string createNewFile()
+        std::string _pathname;
+        std::vector<Slot> _slots;
+        size_t _inflight;  // 在途的写入数
+        uint64_t _offset;  // 下一次写入的文件偏移
+        detail::Uring _ring;
+    };
+
+    namespace detail
+    {
+        // 按大小滚动的文件名 --> 基础文件名 + 时间(默认为当前时间) + "-" + 序号 + ".log"
+        inline std::string sizeRollName(const std::string &basename, size_t count, time_t t = util::Date::now())
         {
-            // 获取系统时间, 以时间来构造文件扩展名
-            time_t t = util::Date::now();
+            // 以时间来构造文件扩展名
             struct tm lt;
             localtime_r(&t, &lt);
             std::stringstream filename;
-            filename << _basename;
+            filename << basename;
             filename << lt.tm_year + 1900;
             filename << lt.tm_mon + 1;
             filename << lt.tm_mday;
@@ -114,24 +687,306 @@ namespace zx
             filename << lt.tm_min;
             filename << lt.tm_sec;
             filename << "-";
-            filename << _name_count++;
+            filename << count;
             filename << ".log";
             return filename.str();
         }
 
+        // 预先创建的下一个文件的临时文件名 --> 基础文件名 + "next-" + 序号 + ".tmp", 切换时改名为 sizeRollName
+        inline std::string sizeTempName(const std::string &basename, size_t count)
+        {
+            return basename + "next-" + std::to_string(count) + ".tmp";
+        }
+    } // namespace detail
+
+    // 3. 滚动文件 --> (以文件大小进行滚动)
+    class FileBySizeSink : public FdSink
+    {
+    public:
+        // 构造时传入文件名, 并打开文件, 将操作句柄给管理起来
+        //  preallocate 为 true 时, 后台线程为下一个文件预先分配 max_size 字节的磁盘空间
+        FileBySizeSink(const std::string &basename, size_t max_size, const SyncOptions &sync = SyncOptions(),
+                       bool preallocate = false)
+            : FdSink(sync), _basename(basename), _max_fsize(max_size), _cur_fsize(0), _name_count(0),
+              _next_count(0), _preallocate(preallocate)
+        {
+            openFile(detail::sizeRollName(_basename, _name_count++));
+            prepareNext();
+        }
+
+    protected:
+        // 当前文件超过指定大小就切换到后台准备好的新文件
+        //  文件名中的时间取切换的时间, 这里只读一次时钟, 生成文件名与改名都在后台线程中完成
+        //  新文件没能打开时继续写入当前文件, 再写入 max_size 字节后重试
+        void beforeWrite(size_t len)
+        {
+            if (_cur_fsize > _max_fsize)
+            {
+                std::string basename = _basename;
+                size_t count = _next_count;
+                time_t t = util::Date::now();
+                switchFile([basename, count, t]()
+                           { return detail::sizeRollName(basename, count, t); });
+                prepareNext();
+                _cur_fsize = 0;
+            }
+            _cur_fsize += len;
+        }
+
+    private:
+        // 下一个文件先以临时文件名创建, 切换时才确定最终的文件名
+        void prepareNext()
+        {
+            std::string basename = _basename;
+            size_t count = _next_count = _name_count++;
+            prepareFile([basename, count]()
+                        { return detail::sizeTempName(basename, count); },
+                        _preallocate ? _max_fsize : 0, O_TRUNC);
+        }
+
     private:
         std::string _basename; // 基础文件名  --> 文件名 = 基础文件名 + 扩展文件名
-        std::ofstream _ofs;
         size_t _max_fsize; // 指定文件可写入的最大大小
         size_t _cur_fsize; // 当前文件大小
         size_t _name_count;
+        size_t _next_count; // 预先创建的文件的序号
+        bool _preallocate;  // 是否为下一个文件预先分配磁盘空间
+    };
+
+    /*
+        内存映射的分段文件, 用于日志量最大的日志器 --> 按大小滚动, 每个分段的大小固定
+            1. 分段文件用 posix_fallocate 预先分配 seg_size 字节并映射到内存, 写入只是 memcpy, 没有系统调用
+            2. 下一个分段总是由后台线程提前创建并映射好, 当前分段写满时直接切换, 旧分段交给后台线程关闭
+            3. 当前分段放不下时, 只写入到最后一个换行为止, 剩下的写入下一个分段, 一行日志不会被拆到两个文件中
+            4. 分段关闭时按实际写入的长度截断文件尾部, 预先创建但没有用到的分段直接删除
+            5. 回写由内核异步完成, 持久化策略通过 msync 实现
+        进程异常退出时, 最后一个分段的尾部会留下没有截断的 0 字节
+        出错时不终止进程:
+            1. 预分配或映射失败(文件系统不支持/磁盘空间不足)时, 该分段改为 pwrite 写入 --> 不映射稀疏文件, 避免写满磁盘时 SIGBUS
+            2. 分段文件打开失败时, 下一次写入换用后台准备的下一个分段; 仍然失败的写入被丢弃, 计入 lostBytes
+    */
+    class MmapFileSink : public LogSink
+    {
+    public:
+        MmapFileSink(const std::string &basename, size_t seg_size, const SyncOptions &sync = SyncOptions())
+            : _basename(basename), _seg_size(pageAlign(std::max<size_t>(seg_size, 1))), _name_count(0),
+              _sync(sync), _synced_at(util::Date::monoNs()), _lost(0), _helper(FileHelper::shared())
+        {
+            _cur = openSegment(_basename, _name_count++, _seg_size);
+            prepareNext();
+        }
+        ~MmapFileSink()
+        {
+            closeSegment(_cur, _sync._policy != SyncPolicy::SYNC_NONE);
+            // 没有用到的分段直接删除
+            std::shared_future<Segment> next = _next;
+            _helper->post([next]()
+                          {
+                Segment seg = next.get();
+                closeSegment(seg, false);
+                ::unlink(seg._path.c_str()); });
+        }
+
+        void log(const char *data, size_t len)
+        {
+            // 当前分段没能打开, 换用后台准备的下一个分段, 仍然不可用时丢弃
+            if (_cur._fd < 0)
+                nextSegment();
+            if (_cur._fd < 0)
+            {
+                _lost.fetch_add(len, std::memory_order_relaxed);
+                return;
+            }
+            while (len > 0)
+            {
+                size_t room = _cur._cap - _cur._used;
+                size_t n = len;
+                if (n > room)
+                {
+                    const char *nl = static_cast<const char *>(memrchr(data, '\n', room));
+                    n = nl != nullptr ? nl - data + 1 : 0;
+                    // 一行日志比整个分段还长, 只能拆开
+                    if (n == 0 && _cur._used == 0)
+                        n = room;
+                }
+                store(_cur, data, n);
+                data += n;
+                len -= n;
+                if (len > 0)
+                {
+                    nextSegment();
+                    if (_cur._fd < 0)
+                    {
+                        _lost.fetch_add(len, std::memory_order_relaxed);
+                        break;
+                    }
+                }
+            }
+            periodicSync();
+        }
+        void sync(LogLevel::value level)
+        {
+            if (_sync._policy == SyncPolicy::SYNC_ON_LEVEL && level >= _sync._level)
+                dataSync(_cur);
+        }
+        void flush() { periodicSync(); }
+        std::chrono::nanoseconds idle() { return periodicSync(); }
+
+        // 因分段文件无法打开或写入失败而丢弃的字节数
+        uint64_t lostBytes() const { return _lost.load(std::memory_order_relaxed); }
+
+    private:
+        struct Segment
+        {
+            Segment() : _fd(-1), _base(nullptr), _cap(0), _used(0), _synced(0) {}
+            std::string _path;
+            int _fd;       // 打开失败时为 -1
+            char *_base;   // 没有映射时为空, 改为 pwrite 写入
+            size_t _cap;    // 分段的大小
+            size_t _used;   // 已经写入的字节数
+            size_t _synced; // 已经落盘的位置
+        };
+
+        static size_t pageSize() { return (size_t)sysconf(_SC_PAGESIZE); }
+        static size_t pageAlign(size_t len) { return (len + pageSize() - 1) / pageSize() * pageSize(); }
+
+        // 创建分段文件, 预先分配空间并映射到内存
+        //  打开失败时 _fd 为 -1; 预分配或映射失败时不映射(_base 为空), 文件保持为空, 由 store 通过 pwrite 写入
+        static Segment openSegment(const std::string &basename, size_t count, size_t size)
+        {
+            Segment seg;
+            seg._path = detail::sizeRollName(basename, count);
+            seg._cap = size;
+            util::File::createDirectory(util::File::path(seg._path));
+            seg._fd = ::open(seg._path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (seg._fd < 0)
+                return seg;
+            // 不能退化为 ftruncate 出来的稀疏文件: 磁盘写满时访问映射会触发 SIGBUS
+            if (posix_fallocate(seg._fd, 0, size) != 0)
+                return seg;
+            void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, seg._fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::ftruncate(seg._fd, 0);
+                return seg;
+            }
+            seg._base = static_cast<char *>(p);
+            return seg;
+        }
+
+        // 写入当前分段: 映射的分段直接拷贝, 否则通过 pwrite 写入; 写入失败的部分计入 lostBytes
+        void store(Segment &seg, const char *data, size_t len)
+        {
+            if (seg._base != nullptr)
+                memcpy(seg._base + seg._used, data, len);
+            else
+            {
+                size_t done = 0;
+                while (done < len)
+                {
+                    ssize_t ret = ::pwrite(seg._fd, data + done, len - done, seg._used + done);
+                    if (ret < 0 && errno == EINTR)
+                        continue;
+                    if (ret <= 0)
+                        break;
+                    done += ret;
+                }
+                _lost.fetch_add(len - done, std::memory_order_relaxed);
+                len = done;
+            }
+            seg._used += len;
+        }
+
+        // 解除映射并按实际写入的长度截断
+        static void closeSegment(Segment &seg, bool sync)
+        {
+            if (seg._fd < 0)
+                return;
+            if (sync)
+                syncSegment(seg);
+            if (seg._base != nullptr)
+            {
+                munmap(seg._base, seg._cap);
+                ::ftruncate(seg._fd, seg._used);
+            }
+            ::close(seg._fd);
+            seg._fd = -1;
+        }
+
+        // 将上次落盘之后写入的部分同步写回磁盘
+        static void syncSegment(Segment &seg)
+        {
+            if (seg._used <= seg._synced)
+                return;
+            if (seg._base != nullptr)
+            {
+                // msync 的起始地址需要按页对齐
+                size_t start = seg._synced - seg._synced % pageSize();
+                msync(seg._base + start, seg._used - start, MS_SYNC);
+            }
+            else
+                ::fdatasync(seg._fd);
+            seg._synced = seg._used;
+        }
+
+        // 在后台线程中创建下一个分段
+        void prepareNext()
+        {
+            auto next = std::make_shared<std::promise<Segment>>();
+            _next = next->get_future().share();
+            std::string basename = _basename;
+            size_t count = _name_count++, size = _seg_size;
+            _helper->post([next, basename, count, size]()
+                          { next->set_value(openSegment(basename, count, size)); });
+        }
+
+        // 换上后台准备好的分段(还没有准备好时等待), 旧分段交给后台线程关闭
+        void nextSegment()
+        {
+            Segment old = _cur;
+            bool sync = _sync._policy != SyncPolicy::SYNC_NONE;
+            _helper->post([old, sync]() mutable
+                          { closeSegment(old, sync); });
+            _cur = _next.get();
+            prepareNext();
+        }
+
+        void dataSync(Segment &seg)
+        {
+            syncSegment(seg);
+            _synced_at = util::Date::monoNs();
+        }
+
+        // 定期落盘的时间到了就落盘; 返回距离下次落盘还有多久, 0 表示没有需要落盘的数据
+        std::chrono::nanoseconds periodicSync()
+        {
+            if (_sync._policy != SyncPolicy::SYNC_PERIODIC || _cur._used <= _cur._synced)
+                return std::chrono::nanoseconds(0);
+            uint64_t interval = std::chrono::duration_cast<std::chrono::nanoseconds>(_sync._interval).count();
+            uint64_t elapsed = util::Date::monoNs() - _synced_at;
+            if (elapsed < interval)
+                return std::chrono::nanoseconds(interval - elapsed);
+            dataSync(_cur);
+            return std::chrono::nanoseconds(0);
+        }
+
+    private:
+        std::string _basename;
+        size_t _seg_size; // 分段的大小, 按页对齐
+        size_t _name_count;
+        SyncOptions _sync;
+        uint64_t _synced_at; // 上次落盘的时间
+        std::atomic<uint64_t> _lost; // 丢弃的字节数
+        FileHelper::ptr _helper;
+        Segment _cur;                      // 正在写入的分段
+        std::shared_future<Segment> _next; // 后台线程创建的下一个分段
     };
 
     /*
         扩展一个以时间作为日志文件滚动切换类型的日志文件
-            1. 以时间进行文件滚动, 实际上是以时间段进行滚动
-                实现思想: 以当前系统时间, 取模时间段大小, 可以得到当前时间段是第几个时间段
-                    每次以当前系统时间取模, 判断与当前文件的时间段是否一致, 不一致代表不是同一个时间段
+            1. 以时间进行文件滚动, 实际上是以时间段进行滚动, 时间段的边界对齐到指定时区的整分/整点/零点
+            2. 打开文件时预先算好下一个边界, 之后每次写入只需要读一次粗粒度时钟并与边界比较
+                到达边界时换上后台准备好的下一个时间段的文件, 再计算新的边界
     */
 
     enum class TimeGap
@@ -142,66 +997,139 @@ namespace zx
         GAP_DAY
     };
 
+    // 时间段边界与文件名所用的时区: 默认为系统本地时区(包括夏令时), 也可以指定与 UTC 的固定偏移
+    struct TimeZone
+    {
+        TimeZone() : _local(true), _offset(0) {}
+        static TimeZone utc(std::chrono::minutes offset = std::chrono::minutes(0))
+        {
+            TimeZone zone;
+            zone._local = false;
+            zone._offset = (long)std::chrono::duration_cast<std::chrono::seconds>(offset).count();
+            return zone;
+        }
+
+        // 该时区中的日历时间
+        struct tm toTm(time_t t) const
+        {
+            struct tm tm;
+            if (_local)
+                localtime_r(&t, &tm);
+            else
+            {
+                t += _offset;
+                gmtime_r(&t, &tm);
+            }
+            return tm;
+        }
+
+        // toTm 的逆运算, 字段可以超出范围(例如 tm_hour = 24)
+        time_t fromTm(struct tm &tm) const
+        {
+            if (_local)
+            {
+                tm.tm_isdst = -1;
+                return mktime(&tm);
+            }
+            return timegm(&tm) - _offset;
+        }
+
+        bool _local;
+        long _offset; // 与 UTC 相差的秒数
+    };
+
     // 3. 滚动文件扩展 --> (以时间进行滚动)
-    class FileByTimeSink : public zx::LogSink
+    class FileByTimeSink : public FdSink
     {
     public:
         // 构造时传入文件名, 并打开文件, 将操作句柄给管理起来
-        FileByTimeSink(const std::string &basename, TimeGap gap_type)
-            : _basename(basename)
+        FileByTimeSink(const std::string &basename, TimeGap gap_type, const SyncOptions &sync = SyncOptions(),
+                       const TimeZone &zone = TimeZone())
+            : FdSink(sync), _basename(basename), _gap_type(gap_type), _zone(zone)
         {
-            switch (gap_type)
+            time_t now = util::Date::coarseNow();
+            _deadline = nextBoundary(now);
+            openFile(createNewFile(_basename, _zone, periodStart(now)));
+            prepareNext();
+        }
+
+    protected:
+        // 到达边界就切换到新文件: 进入的是紧接着的下一个时间段时, 换上后台准备好的文件
+        //  新文件没能打开时继续写入当前文件, 到下一个边界再试
+        void beforeWrite(size_t)
+        {
+            time_t now = util::Date::coarseNow();
+            if (now < _deadline)
+                return;
+            if (now < _next_deadline)
+            {
+                switchFile();
+                _deadline = _next_deadline;
+            }
+            else
+            {
+                // 中间有整段时间没有日志, 当场打开当前时间段的文件
+                openFile(createNewFile(_basename, _zone, periodStart(now)));
+                _deadline = nextBoundary(now);
+            }
+            prepareNext();
+        }
+
+    private:
+        // 在后台线程中提前打开下一个时间段的文件
+        void prepareNext()
+        {
+            std::string basename = _basename;
+            TimeZone zone = _zone;
+            time_t start = _deadline;
+            _next_deadline = nextBoundary(start);
+            prepareFile([basename, zone, start]()
+                        { return createNewFile(basename, zone, start); });
+        }
+
+        // 包含 t 的时间段的起始时间
+        time_t periodStart(time_t t) const
+        {
+            if (_gap_type == TimeGap::GAP_SECOND)
+                return t;
+            struct tm tm = _zone.toTm(t);
+            tm.tm_sec = 0;
+            if (_gap_type != TimeGap::GAP_MINUTE)
+                tm.tm_min = 0;
+            if (_gap_type == TimeGap::GAP_DAY)
+                tm.tm_hour = 0;
+            return _zone.fromTm(tm);
+        }
+
+        // t 之后的第一个时间段边界
+        time_t nextBoundary(time_t t) const
+        {
+            if (_gap_type == TimeGap::GAP_SECOND)
+                return t + 1;
+            struct tm tm = _zone.toTm(periodStart(t));
+            switch (_gap_type)
             {
-            case TimeGap::GAP_SECOND:
-                _gap_size = 1;
-                break;
             case TimeGap::GAP_MINUTE:
-                _gap_size = 60;
+                ++tm.tm_min;
                 break;
             case TimeGap::GAP_HOUR:
-                _gap_size = 3600;
-                break;
-            case TimeGap::GAP_DAY:
-                _gap_size = 3600 * 24;
+                ++tm.tm_hour;
                 break;
             default:
+                ++tm.tm_mday;
                 break;
             }
-            // 获取当前是第几个时间段
-            _cur_gap = _gap_size == 1 ? zx::util::Date::now() : zx::util::Date::now() % _gap_size;
-            std::string filename = createNewFile();
-            // 1. 创建日志文件所在的目录
-            zx::util::File::createDirectory(zx::util::File::path(filename));
-            // 2. 创建并打开文件
-            _ofs.open(filename, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
+            time_t next = _zone.fromTm(tm);
+            // 夏令时切换时本地时间可能重复, 保证边界总是向前推进
+            return next > t ? next : t + 1;
         }
 
-        // 将日志消息写入指定文件
-        void log(const char *data, size_t len)
+        // 以时间段的起始时间来构造文件扩展名
+        static std::string createNewFile(const std::string &basename, const TimeZone &zone, time_t t)
         {
-            time_t cur = zx::util::Date::now();
-            if ((cur % _gap_size) != _cur_gap)
-            {
-                // 关闭已经打开的文件
-                _ofs.close();
-                std::string filename = createNewFile();
-                _ofs.open(filename, std::ios::binary | std::ios::app);
-                assert(_ofs.is_open());
-            }
-            _ofs.write(data, len);
-            assert(_ofs.good());
-        }
-
-    private:
-        std::string createNewFile()
-        {
-            // 获取系统时间, 以时间来构造文件扩展名
-            time_t t = zx::util::Date::now();
-            struct tm lt;
-            localtime_r(&t, &lt);
+            struct tm lt = zone.toTm(t);
             std::stringstream filename;
-            filename << _basename;
+            filename << basename;
             filename << lt.tm_year + 1900;
             filename << lt.tm_mon + 1;
             filename << lt.tm_mday;
@@ -214,9 +1142,10 @@ namespace zx
 
     private:
         std::string _basename; // 基础文件名  --> 文件名 = 基础文件名 + 扩展文件名
-        std::ofstream _ofs;
-        size_t _cur_gap;  // 当前是第几个时间段
-        size_t _gap_size; // 时间段的大小
+        TimeGap _gap_type;     // 时间段的大小
+        TimeZone _zone;
+        time_t _deadline;      // 当前时间段的结束时间
+        time_t _next_deadline; // 下一个时间段(后台准备的文件)的结束时间
     };
 
     // 简单工厂模式
@@ -0,0 +1,166 @@
+/*
+    io_uring 的最小封装, 只提供文件落地需要的写入与收割
+        1. 直接使用 io_uring_setup/io_uring_enter 系统调用与共享内存中的环, 不依赖 liburing
+        2. 只有一个线程使用: 提交与收割都在落地方向所在的线程中完成
+        3. 非 Linux 平台或内核不支持(被禁用)时 init 返回 false, 由调用者退化为普通的写入
+*/
+#ifndef __M_URING_H__
+#define __M_URING_H__
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ZX_HAVE_URING 1
+#endif
+#endif
+#endif
+
+namespace zx
+{
+    namespace detail
+    {
+#ifdef ZX_HAVE_URING
+        class Uring
+        {
+        public:
+            Uring() : _fd(-1), _sq_ptr(MAP_FAILED), _cq_ptr(MAP_FAILED), _sqes(nullptr) {}
+            ~Uring() { close(); }
+            Uring(const Uring &) = delete;
+            Uring &operator=(const Uring &) = delete;
+
+            // 创建可以同时容纳 entries 个请求的环, 失败时返回 false
+            bool init(unsigned entries)
+            {
+                struct io_uring_params p;
+                memset(&p, 0, sizeof(p));
+                _fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+                if (_fd < 0)
+                    return false;
+                _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+                _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+                _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+                _cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+                void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+                if (_sq_ptr == MAP_FAILED || _cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+                {
+                    if (sqes != MAP_FAILED)
+                        munmap(sqes, _sqes_size);
+                    close();
+                    return false;
+                }
+                _sqes = static_cast<struct io_uring_sqe *>(sqes);
+                char *sq = static_cast<char *>(_sq_ptr), *cq = static_cast<char *>(_cq_ptr);
+                _sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+                _sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+                _sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+                _cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+                _cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+                _cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+                _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+                return true;
+            }
+
+            bool ok() const { return _fd >= 0; }
+
+            // 提交一个在 off 处写入 [buf, buf + len) 的请求, 完成事件带回 tag; 提交失败返回 false, 请求不会被执行
+            //  调用者保证在途的请求数不超过 init 时的 entries
+            bool write(int fd, const char *buf, size_t len, uint64_t off, uint64_t tag)
+            {
+                unsigned tail = *_sq_tail;
+                unsigned idx = tail & _sq_mask;
+                struct io_uring_sqe *sqe = &_sqes[idx];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->fd = fd;
+                sqe->off = off;
+                sqe->addr = (uint64_t)(uintptr_t)buf;
+                sqe->len = (uint32_t)len;
+                sqe->user_data = tag;
+                _sq_array[idx] = idx;
+                __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+                if (enter(1, 0, 0) > 0)
+                    return true;
+                // 内核没有取走这个请求, 撤回尾指针, 否则它会在下一次 enter 时被提交
+                __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+                return false;
+            }
+
+            // 取出一个完成事件, res 为写入的字节数或负的错误码; wait 为 false 时没有完成事件直接返回 false
+            bool reap(uint64_t &tag, int &res, bool wait)
+            {
+                while (true)
+                {
+                    unsigned head = *_cq_head;
+                    if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+                    {
+                        struct io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+                        tag = cqe->user_data;
+                        res = cqe->res;
+                        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+                        return true;
+                    }
+                    if (!wait || enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+                        return false;
+                }
+            }
+
+            void close()
+            {
+                if (_sqes != nullptr)
+                    munmap(_sqes, _sqes_size);
+                if (_sq_ptr != MAP_FAILED)
+                    munmap(_sq_ptr, _sq_size);
+                if (_cq_ptr != MAP_FAILED)
+                    munmap(_cq_ptr, _cq_size);
+                if (_fd >= 0)
+                    ::close(_fd);
+                _fd = -1;
+                _sq_ptr = _cq_ptr = MAP_FAILED;
+                _sqes = nullptr;
+            }
+
+        private:
+            int enter(unsigned submit, unsigned complete, unsigned flags)
+            {
+                int ret;
+                do
+                {
+                    ret = (int)syscall(__NR_io_uring_enter, _fd, submit, complete, flags, nullptr, 0);
+                } while (ret < 0 && errno == EINTR);
+                return ret;
+            }
+
+        private:
+            int _fd;
+            void *_sq_ptr, *_cq_ptr;
+            size_t _sq_size, _cq_size, _sqes_size;
+            struct io_uring_sqe *_sqes;
+            unsigned *_sq_tail, *_sq_array;
+            unsigned *_cq_head, *_cq_tail;
+            unsigned _sq_mask, _cq_mask;
+            struct io_uring_cqe *_cqes;
+        };
+#else
+        // 不支持 io_uring 的平台: 总是退化为普通的写入
+        class Uring
+        {
+        public:
+            bool init(unsigned) { return false; }
+            bool ok() const { return false; }
+            bool write(int, const char *, size_t, uint64_t, uint64_t) { return false; }
+            bool reap(uint64_t &, int &, bool) { return false; }
+            void close() {}
+        };
+#endif
+    } // namespace detail
+} // namespace zx
+
+#endif
@@ -6,12 +6,14 @@
  *    2. 判断文件是否存在
  *    3. 获取文件所在路径
  *    4. 创建目录
+ *    5. 获取文件名
  */
 
 #include <iostream>
 #include <string>
 #include <sys/stat.h>
 #include <ctime>
+#include <cstdint>
 // #include <unistd.h>
 
 namespace zx
@@ -26,6 +28,43 @@ namespace zx
             {
                 return (size_t)time(nullptr);
             }
+
+            // 粗粒度的系统时间(秒), 精度为一个时钟节拍 --> 只读取 vDSO 中缓存的时间, 比 time() 更便宜
+            static time_t coarseNow()
+            {
+#ifdef CLOCK_REALTIME_COARSE
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+                return ts.tv_sec;
+#else
+                return time(nullptr);
+#endif
+            }
+
+            // 纳秒精度的系统时间 --> clock_gettime 通过 vDSO 完成, 不会陷入内核
+            static struct timespec nowSpec()
+            {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                return ts;
+            }
+
+            // 时间戳换算为纳秒数
+            static uint64_t toNs(const struct timespec &ts)
+            {
+                return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+            }
+
+            // 纳秒精度的系统时间, 与日志中打印的时间戳是同一个时钟
+            static uint64_t realNs() { return toNs(nowSpec()); }
+
+            // 单调时钟的纳秒数, 不受系统时间调整影响, 用于计时
+            static uint64_t monoNs()
+            {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+            }
         };
 
         // 文件类
@@ -44,6 +83,12 @@ namespace zx
                 // return (access(pathname.c_str(), F_OK) == 0);
             }
 
+            // 获取路径中的文件名部分, 可在编译期对 __FILE__ 求值
+            static constexpr const char *basename(const char *pathname)
+            {
+                return basename(pathname, pathname);
+            }
+
             // 获取文件所在路径
             static std::string path(const std::string &pathname)
             {
@@ -80,6 +125,12 @@ namespace zx
                     idx = pos + 1;
                 }
             }
+
+        private:
+            static constexpr const char *basename(const char *p, const char *last)
+            {
+                return *p == '\0' ? last : basename(p + 1, (*p == '/' || *p == '\\') ? p + 1 : last);
+            }
         };
     }
 }